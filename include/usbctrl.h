@@ -30,6 +30,12 @@
  *
  **/
 
+#ifndef _USBCTRL_H_
+#define _USBCTRL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
 /*
  * The following table is are published properties by this library
  */
@@ -43,12 +49,19 @@ RUSBCTRL_PROPNAME_SERIAL,         //"serial"
 // Interface Level
 RUSBCTRL_PROPNAME_DEVTYPE,        //"bInterfaceClass"
 RUSBCTRL_PROPNAME_DEVSUBTYPE,     // "bInterfaceSubClass"
+// Device Level, numeric
+RUSBCTRL_PROPNAME_DEVCLASS,       // "bDeviceClass"
+RUSBCTRL_PROPNAME_DEVSUBCLASS,    // "bDeviceSubClass"
+RUSBCTRL_PROPNAME_SPEED,          // "speed"
+RUSBCTRL_PROPNAME_BUSNUM,         // "busnum"
+RUSBCTRL_PROPNAME_DEVNUM,         // "devnum"
 } rusbCtrl_propname_t;
 
 
 typedef enum {
 	RUSBCTRL_SUCCESS = 0,
-	RUSBCTRL_FAILURE = -1
+	RUSBCTRL_FAILURE = -1,
+	RUSBCTRL_TIMEOUT = -2
 } rusbCtrl_result_t;
 
 /**
@@ -66,6 +79,196 @@ typedef enum {
  */
 typedef void (*rusbCtrl_devCallback_t)(int devId, int inserted, void *cbData);
 
+/**
+ * @brief A call queued by rusbCtrl_runAfterDispatch().
+ *
+ * @param[in] cbData	Callback data.
+ */
+typedef void (*rusbCtrl_deferredCall_t)(void *cbData);
+
+/**
+ * @brief Device descriptor, as reported by the device.
+ */
+typedef struct {
+	uint16_t bcdUSB;
+	uint8_t deviceClass;
+	uint8_t deviceSubClass;
+	uint8_t deviceProtocol;
+	uint8_t maxPacketSize0;
+	uint16_t vendorId;
+	uint16_t productId;
+	uint16_t bcdDevice;
+	uint8_t numConfigurations;
+} rusbCtrl_deviceDescriptor_t;
+
+/**
+ * @brief Configuration descriptor.
+ *
+ * maxPowerMilliAmps is bMaxPower already scaled for the bus speed (2 mA units, 8 mA on SuperSpeed).
+ * numInterfaces counts interface descriptors, so each alternate setting is counted separately.
+ */
+typedef struct {
+	uint8_t configurationValue;
+	uint8_t attributes;
+	uint8_t selfPowered;
+	uint8_t remoteWakeup;
+	uint16_t maxPowerMilliAmps;
+	uint8_t numInterfaces;
+} rusbCtrl_configDescriptor_t;
+
+typedef struct {
+	uint8_t interfaceNumber;
+	uint8_t alternateSetting;
+	uint8_t interfaceClass;
+	uint8_t interfaceSubClass;
+	uint8_t interfaceProtocol;
+	uint8_t numEndpoints;
+} rusbCtrl_interfaceDescriptor_t;
+
+typedef enum {
+	RUSBCTRL_ENDPOINT_CONTROL = 0,
+	RUSBCTRL_ENDPOINT_ISOCHRONOUS,
+	RUSBCTRL_ENDPOINT_BULK,
+	RUSBCTRL_ENDPOINT_INTERRUPT
+} rusbCtrl_endpointType_t;
+
+/**
+ * @brief Endpoint descriptor. maxPacketSize excludes the high-bandwidth bits, which are reported as
+ * transactionsPerMicroframe (1 to 3).
+ */
+typedef struct {
+	uint8_t address;
+	uint8_t directionIn;
+	rusbCtrl_endpointType_t type;
+	uint16_t maxPacketSize;
+	uint8_t transactionsPerMicroframe;
+	uint8_t interval;
+} rusbCtrl_endpointDescriptor_t;
+
+/**
+ * @brief Reference to a connected device. It keeps the device's cached properties readable
+ * after the device has been removed, until it is released with rusbCtrl_releaseDevice().
+ */
+typedef struct rusbCtrl_device_s *rusbCtrl_device_t;
+
+/**
+ * @brief Selects which fields of rusbCtrl_deviceMatch_t take part in a match. Flags can be OR'ed.
+ */
+typedef enum {
+	RUSBCTRL_MATCH_VENDOR  = 0x01,
+	RUSBCTRL_MATCH_PRODUCT = 0x02,
+	RUSBCTRL_MATCH_CLASS   = 0x04,
+	RUSBCTRL_MATCH_SERIAL  = 0x08
+} rusbCtrl_matchFlags_t;
+
+/**
+ * @brief Describes a set of USB devices.
+ *
+ * A device matches when every field selected in flags is equal. Fields not selected are ignored.
+ * deviceClass is compared against bDeviceClass and against bInterfaceClass of each interface,
+ * so a rule on class 0x08 also catches mass-storage devices that declare their class per interface.
+ * A filter with RUSBCTRL_MATCH_SERIAL set and a NULL serial is rejected with RUSBCTRL_FAILURE.
+ */
+typedef struct {
+	unsigned int flags;
+	uint16_t vendorId;
+	uint16_t productId;
+	uint8_t deviceClass;
+	const char *serial;
+} rusbCtrl_deviceMatch_t;
+
+typedef enum {
+	RUSBCTRL_POLICY_ALLOW = 0,
+	RUSBCTRL_POLICY_DENY
+} rusbCtrl_policyAction_t;
+
+/**
+ * @brief Runtime statistics of the library.
+ *
+ * Policy decision latency is measured from the arrival of the udev 'add' event on the monitor
+ * thread until the "authorized" attribute has been written. recordLockContentions counts the
+ * acquisitions of the device record lock that had to wait for another thread.
+ *
+ * With early notification enabled, the early and ready latencies are both measured from the receipt of
+ * the kernel uevent on the monitor thread. The early latency runs until the RUSBCTRL_EVENT_ARRIVING
+ * callback has returned, the ready latency until the RUSBCTRL_EVENT_READY callback is made. Their
+ * difference is roughly the time udevd took to process the device.
+ *
+ * The enumeration fields describe the device scan of the last rusbCtrl_init(): the number of devices found,
+ * the total time taken, and the part of it spent reading their sysfs attributes.
+ */
+typedef struct {
+	unsigned long policyDecisions;
+	unsigned long policyDenied;
+	unsigned long policyLastDecisionUsecs;
+	unsigned long policyMaxDecisionUsecs;
+	unsigned long policyTotalDecisionUsecs;
+	unsigned long recordLockAcquisitions;
+	unsigned long recordLockContentions;
+	unsigned long earlyEvents;
+	unsigned long earlyLastUsecs;
+	unsigned long earlyMaxUsecs;
+	unsigned long earlyTotalUsecs;
+	unsigned long readyEvents;
+	unsigned long readyLastUsecs;
+	unsigned long readyMaxUsecs;
+	unsigned long readyTotalUsecs;
+	unsigned long enumeratedDevices;
+	unsigned long enumerationUsecs;
+	unsigned long enumerationPrefetchUsecs;
+} rusbCtrl_stats_t;
+
+typedef enum {
+	RUSBCTRL_EVENT_ARRIVING = 0,	/**< The kernel has announced the device; udev has not processed it yet. */
+	RUSBCTRL_EVENT_READY		/**< udev has processed the device and it has a devId. */
+} rusbCtrl_eventType_t;
+
+/**
+ * @brief Early notification event. The two events of one device carry the same syspath.
+ *
+ * On RUSBCTRL_EVENT_ARRIVING, devId is 0 and vendorId/productId are taken from the kernel uevent.
+ * On RUSBCTRL_EVENT_READY, devId can be used with the rest of the API. elapsedUsecs is the time since
+ * the matching RUSBCTRL_EVENT_ARRIVING, or 0 if there was none.
+ */
+typedef struct {
+	rusbCtrl_eventType_t type;
+	int devId;
+	const char *syspath;
+	uint16_t vendorId;
+	uint16_t productId;
+	unsigned long elapsedUsecs;
+} rusbCtrl_event_t;
+
+/**
+ * @brief Callback for early notification events. The event and its strings are only valid during the call.
+ */
+typedef void (*rusbCtrl_eventCallback_t)(const rusbCtrl_event_t *event, void *cbData);
+
+typedef enum {
+	RUSBCTRL_LOG_ERROR = 0,
+	RUSBCTRL_LOG_WARN,
+	RUSBCTRL_LOG_INFO,
+	RUSBCTRL_LOG_DEBUG
+} rusbCtrl_logLevel_t;
+
+typedef enum {
+	RUSBCTRL_LOG_SINK_STDOUT = 0,
+	RUSBCTRL_LOG_SINK_SYSLOG,
+	RUSBCTRL_LOG_SINK_FILE,
+	RUSBCTRL_LOG_SINK_CALLBACK
+} rusbCtrl_logSink_t;
+
+/**
+ * @brief The callback receives every log line that passes the current level when the callback sink is selected.
+ *
+ * It is invoked from the library's log writer thread, never from the thread that logged.
+ *
+ * @param[in] level	Level of the message.
+ * @param[in] message	NUL-terminated message, including the trailing newline. Valid only during the call.
+ * @param[in] cbData	Callback data.
+ */
+typedef void (*rusbCtrl_logCallback_t)(rusbCtrl_logLevel_t level, const char *message, void *cbData);
+
 /** @} */  //END OF GROUP USB_CNTRL_TYPES
 
 /**
@@ -118,4 +321,231 @@ int rusbCtrl_registerCallback(rusbCtrl_devCallback_t cb, void *cbData, int **dev
  */
 char *rusbCtrl_getProperty(int devId, const char *propertyName);
 
+/**
+ * @brief These APIs return numeric device properties without string conversion.
+ *
+ * Values are parsed once when the device is inserted. Speed is reported in kbit/s
+ * (1500 for low speed, 480000 for high speed).
+ *
+ * @param[in] devId		Device ID.
+ * @param[out] value		Property value.
+ *
+ * @return Returns status of the operation. Fails if the device is unknown or does not publish the property.
+ */
+int rusbCtrl_getVendorId(int devId, uint16_t *vendorId);
+int rusbCtrl_getProductId(int devId, uint16_t *productId);
+int rusbCtrl_getDeviceClass(int devId, uint8_t *deviceClass);
+int rusbCtrl_getDeviceSubClass(int devId, uint8_t *deviceSubClass);
+int rusbCtrl_getSpeed(int devId, uint32_t *speedKbps);
+int rusbCtrl_getBusNum(int devId, uint16_t *busNum);
+int rusbCtrl_getDevNum(int devId, uint16_t *devNum);
+
+/**
+ * @brief This API blocks until a device matching the filter is connected.
+ *
+ * A device that is already connected satisfies the wait immediately. Otherwise the caller sleeps until the
+ * monitor thread adds a record; there is no polling.
+ *
+ * @param[in] filter		Devices to wait for. A filter with no flags set matches any device.
+ * @param[in] timeoutMs		Maximum time to wait in milliseconds. 0 only checks connected devices, a negative value waits forever.
+ * @param[out] devId		Device ID of the first matching device.
+ *
+ * @return Returns RUSBCTRL_SUCCESS, RUSBCTRL_TIMEOUT if no matching device showed up in time, or RUSBCTRL_FAILURE.
+ *
+ * @note
+ * Must not be called from a callback, since callbacks run on the thread that delivers new devices.
+ */
+int rusbCtrl_waitForDevice(const rusbCtrl_deviceMatch_t *filter, int timeoutMs, int *devId);
+
+/**
+ * @brief This API checks a connected device against a filter.
+ *
+ * @return Returns RUSBCTRL_SUCCESS if the device is connected and matches, RUSBCTRL_FAILURE otherwise.
+ */
+int rusbCtrl_matchDevice(int devId, const rusbCtrl_deviceMatch_t *filter);
+
+/**
+ * @brief These APIs return the USB descriptors of a device.
+ *
+ * The binary "descriptors" sysfs file is read and parsed once when the device is inserted, so these calls do
+ * no I/O. Configurations, interfaces and endpoints are addressed by position, starting at 0; use the counts in
+ * the parent descriptor to iterate.
+ *
+ * @return Returns status of the operation. Fails if the device is unknown, its descriptors could not be read,
+ * or an index is out of range.
+ */
+int rusbCtrl_getDeviceDescriptor(int devId, rusbCtrl_deviceDescriptor_t *descriptor);
+int rusbCtrl_getConfigDescriptor(int devId, int configIndex, rusbCtrl_configDescriptor_t *descriptor);
+int rusbCtrl_getInterfaceDescriptor(int devId, int configIndex, int interfaceIndex, rusbCtrl_interfaceDescriptor_t *descriptor);
+int rusbCtrl_getEndpointDescriptor(int devId, int configIndex, int interfaceIndex, int endpointIndex,
+		rusbCtrl_endpointDescriptor_t *descriptor);
+
+/**
+ * @brief This API adds a callback for USB insert/remove events, in addition to the one set by rusbCtrl_registerCallback().
+ *
+ * Any number of listeners can be added. rusbCtrl_term() does not remove them.
+ *
+ * @param[in] cb		Callback Function.
+ * @param[in] cbData		Callback Data.
+ * @param[out] listenerId	Identifier to pass to rusbCtrl_removeListener().
+ *
+ * @return Returns status of the operation.
+ */
+int rusbCtrl_addListener(rusbCtrl_devCallback_t cb, void *cbData, int *listenerId);
+
+/**
+ * @brief This API removes a listener. Once it returns, the callback is not running and will not be invoked again.
+ *
+ * It may be called from within a callback. When called from another thread, it waits for a callback in progress,
+ * so the caller must not hold anything that callback needs.
+ *
+ * @return Returns status of the operation.
+ */
+int rusbCtrl_removeListener(int listenerId);
+
+/**
+ * @brief This API runs a call once the listener dispatch in progress on the calling thread is done.
+ *
+ * Listeners run with the library's dispatch lock held, so anything that may block on another thread, such as
+ * resuming a coroutine, should not be done from within the listener. Calls queued here run on the same thread, in
+ * order, after the outermost dispatch has released the lock. Outside a listener the call is made immediately.
+ *
+ * @param[in] call		Function to call.
+ * @param[in] cbData		Callback Data.
+ *
+ * @return Returns status of the operation.
+ */
+int rusbCtrl_runAfterDispatch(rusbCtrl_deferredCall_t call, void *cbData);
+
+/**
+ * @brief This API enables early notification of inserted devices. Pass a NULL cb to disable it again.
+ *
+ * udev only reports a device after udevd has run all its rules for it, which can take hundreds of milliseconds.
+ * In this mode the library also listens to the kernel's own uevents and calls cb with RUSBCTRL_EVENT_ARRIVING as soon
+ * as the kernel announces a device, then with RUSBCTRL_EVENT_READY once udev has processed it and the regular
+ * callbacks have been made. Use the arriving event for user feedback only: device nodes, permissions and
+ * properties may not be in place yet. The callback runs on the monitor thread, like the others.
+ *
+ * @param[in] cb		Callback Function.
+ * @param[in] cbData		Callback Data.
+ *
+ * @return Returns status of the operation.
+ */
+int rusbCtrl_enableEarlyNotification(rusbCtrl_eventCallback_t cb, void *cbData);
+
+/**
+ * @brief These APIs acquire a reference to a connected device, either by ID or as the connected device with the
+ * smallest ID greater than afterDevId (pass 0 to start). Devices are visited in ID order without copying the list.
+ *
+ * @return On success returns a device reference that must be released with rusbCtrl_releaseDevice(). On failure returns NULL.
+ */
+rusbCtrl_device_t rusbCtrl_acquireDevice(int devId);
+rusbCtrl_device_t rusbCtrl_acquireNextDevice(int afterDevId);
+void rusbCtrl_releaseDevice(rusbCtrl_device_t device);
+
+/**
+ * @brief This API returns the device ID of a device reference, or -1 for NULL.
+ */
+int rusbCtrl_deviceGetId(rusbCtrl_device_t device);
+
+/**
+ * @brief This API returns a cached property of a device reference without copying it.
+ *
+ * @param[in] device		Device reference.
+ * @param[in] property		Property.
+ * @param[out] length		Optional. Length of the value, excluding the terminating NUL.
+ *
+ * @return On success returns the NUL-terminated value, which stays valid until the reference is released. On failure returns NULL.
+ */
+const char *rusbCtrl_deviceGetProperty(rusbCtrl_device_t device, rusbCtrl_propname_t property, size_t *length);
+
+/**
+ * @brief This API returns a numeric property of a device reference, with the same units as rusbCtrl_getVendorId() and friends.
+ *
+ * @return Returns status of the operation.
+ */
+int rusbCtrl_deviceGetNumericProperty(rusbCtrl_device_t device, rusbCtrl_propname_t property, uint32_t *value);
+
+/**
+ * @brief This API appends a rule to the device authorization policy.
+ *
+ * Rules are evaluated on the monitor thread as soon as the 'add' event arrives, before the device record
+ * is created and before any callback is invoked. Devices that are already connected are evaluated by
+ * rusbCtrl_init(), so rules should be added before it is called. The first matching rule, in the order
+ * rules were added, decides; if no rule matches, the default action applies. The decision is written to
+ * the device's "authorized" sysfs attribute. De-authorized devices are not reported to the application:
+ * they get no devId, no callback and are not found by rusbCtrl_waitForDevice(). Hubs (bDeviceClass 0x09),
+ * including the root hubs, are exempt and always stay authorized, since de-authorizing one would disconnect
+ * every device behind it; a deny-by-default policy with ALLOW rules for specific devices is therefore safe.
+ *
+ * @param[in] match		Devices the rule applies to. The serial string is copied.
+ * @param[in] action		Action to take on matching devices.
+ *
+ * @return Returns status of the operation.
+ *
+ * @note
+ * The kernel may bind drivers before udev reports the device. To close that window completely, set the
+ * hubs' authorized_default attribute to 0 and add ALLOW rules for the devices that should work.
+ */
+int rusbCtrl_addPolicyRule(const rusbCtrl_deviceMatch_t *match, rusbCtrl_policyAction_t action);
+
+/**
+ * @brief This API sets the action applied to devices that match no policy rule. Default is RUSBCTRL_POLICY_ALLOW.
+ *
+ * @return Returns status of the operation.
+ */
+int rusbCtrl_setDefaultPolicy(rusbCtrl_policyAction_t action);
+
+/**
+ * @brief This API removes all policy rules and restores the default action to RUSBCTRL_POLICY_ALLOW.
+ * With no rules and an ALLOW default, the policy engine is idle and does not touch sysfs.
+ *
+ * @return Returns status of the operation.
+ */
+int rusbCtrl_clearPolicyRules(void);
+
+/**
+ * @brief This API fills in a snapshot of the library statistics.
+ *
+ * @param[out] stats		Statistics.
+ *
+ * @return Returns status of the operation.
+ */
+int rusbCtrl_getStats(rusbCtrl_stats_t *stats);
+
+/**
+ * @brief This API sets the most verbose level that is logged. Takes effect immediately on all threads.
+ *
+ * The initial level is RUSBCTRL_LOG_INFO, or the value of the RUSBCTRL_LOG_LEVEL environment variable (0-3) if set.
+ *
+ * @return Returns status of the operation.
+ */
+int rusbCtrl_setLogLevel(rusbCtrl_logLevel_t level);
+
+/**
+ * @brief This API selects where log lines are written.
+ *
+ * Logging threads only copy the formatted line into a per-thread ring buffer; a writer thread owned by the library
+ * drains the rings and writes to the sink, so a slow console or file never stalls the monitor thread. Lines are
+ * dropped, and the drop is reported, if a ring fills up faster than the sink accepts them.
+ *
+ * @param[in] sink		Sink to use. For RUSBCTRL_LOG_SINK_CALLBACK use rusbCtrl_setLogCallback() instead.
+ * @param[in] filePath		File to append to. Only used with RUSBCTRL_LOG_SINK_FILE.
+ *
+ * @return Returns status of the operation.
+ */
+int rusbCtrl_setLogSink(rusbCtrl_logSink_t sink, const char *filePath);
+
+/**
+ * @brief This API routes log lines to a user callback. Passing NULL restores the stdout sink.
+ *
+ * The callback runs on the library's writer thread without any library lock held, so it may change the sink itself.
+ * Once this API or rusbCtrl_setLogSink() returns, the previous callback is not running and will not be invoked again.
+ *
+ * @return Returns status of the operation.
+ */
+int rusbCtrl_setLogCallback(rusbCtrl_logCallback_t cb, void *cbData);
+
 /** @} */  //END OF GROUP USB_CNTRL_APIS
+
+#endif /* _USBCTRL_H_ */
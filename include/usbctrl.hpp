@@ -0,0 +1,314 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+/**
+ * @defgroup USB_CNTRL_CXX USB Control C++ API
+ * @ingroup  USB_CNTRL
+ *
+ * Header-only C++17 layer over the C API.
+ *
+ * @code
+ * usbctrl::subscription events = usbctrl::subscribe([](int devId, bool inserted) { ... });
+ * for(const usbctrl::device &dev : usbctrl::devices())
+ * {
+ *     std::string_view product = dev.product();    // points into the library's cache, no copy
+ * }
+ * @endcode
+ **/
+
+#ifndef _USBCTRL_HPP_
+#define _USBCTRL_HPP_
+
+#if __cplusplus < 201703L
+#error "usbctrl.hpp requires C++17"
+#endif
+
+#include "usbctrl.h"
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <utility>
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define USBCTRL_HAS_COROUTINES 1
+#endif
+
+namespace usbctrl
+{
+
+/**
+ * @addtogroup USB_CNTRL_CXX
+ * @{
+ */
+
+/**
+ * @brief Move-only reference to a connected device.
+ *
+ * Property views returned by a device stay valid for as long as the device object exists, even if the
+ * device is unplugged in the meantime.
+ */
+class device
+{
+	public:
+	device() noexcept = default;
+	explicit device(int devId) noexcept : m_handle(rusbCtrl_acquireDevice(devId)) {}
+	device(device &&other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+	device & operator=(device &&other) noexcept
+	{
+		if(this != &other)
+		{
+			reset();
+			m_handle = std::exchange(other.m_handle, nullptr);
+		}
+		return *this;
+	}
+	device(const device &) = delete;
+	device & operator=(const device &) = delete;
+	~device() {reset();}
+
+	/** @brief Takes over a reference obtained from rusbCtrl_acquireDevice() or rusbCtrl_acquireNextDevice(). */
+	static device adopt(rusbCtrl_device_t handle) noexcept {return device(handle);}
+
+	explicit operator bool() const noexcept {return (nullptr != m_handle);}
+	int id() const noexcept {return rusbCtrl_deviceGetId(m_handle);}
+	rusbCtrl_device_t native_handle() const noexcept {return m_handle;}
+
+	/** @brief Returns the cached property, or an empty view if the device does not publish it. */
+	std::string_view property(rusbCtrl_propname_t name) const noexcept
+	{
+		size_t length = 0;
+		const char *value = rusbCtrl_deviceGetProperty(m_handle, name, &length);
+		return ((nullptr == value) ? std::string_view() : std::string_view(value, length));
+	}
+	std::string_view manufacturer() const noexcept {return property(RUSBCTRL_PROPNAME_MANUFACTURER);}
+	std::string_view product() const noexcept {return property(RUSBCTRL_PROPNAME_PRODUCT);}
+	std::string_view serial() const noexcept {return property(RUSBCTRL_PROPNAME_SERIAL);}
+
+	std::optional<uint16_t> vendor_id() const noexcept {return numeric<uint16_t>(RUSBCTRL_PROPNAME_VENDOR);}
+	std::optional<uint16_t> product_id() const noexcept {return numeric<uint16_t>(RUSBCTRL_PROPNAME_MODEL);}
+	std::optional<uint8_t> device_class() const noexcept {return numeric<uint8_t>(RUSBCTRL_PROPNAME_DEVCLASS);}
+	std::optional<uint8_t> device_subclass() const noexcept {return numeric<uint8_t>(RUSBCTRL_PROPNAME_DEVSUBCLASS);}
+	std::optional<uint32_t> speed_kbps() const noexcept {return numeric<uint32_t>(RUSBCTRL_PROPNAME_SPEED);}
+	std::optional<uint16_t> bus_number() const noexcept {return numeric<uint16_t>(RUSBCTRL_PROPNAME_BUSNUM);}
+	std::optional<uint16_t> device_number() const noexcept {return numeric<uint16_t>(RUSBCTRL_PROPNAME_DEVNUM);}
+
+	void reset() noexcept
+	{
+		if(nullptr != m_handle)
+		{
+			rusbCtrl_releaseDevice(std::exchange(m_handle, nullptr));
+		}
+	}
+
+	private:
+	explicit device(rusbCtrl_device_t handle) noexcept : m_handle(handle) {}
+
+	template <typename T>
+	std::optional<T> numeric(rusbCtrl_propname_t name) const noexcept
+	{
+		uint32_t value;
+		if(RUSBCTRL_SUCCESS != rusbCtrl_deviceGetNumericProperty(m_handle, name, &value))
+		{
+			return std::nullopt;
+		}
+		return static_cast<T>(value);
+	}
+
+	rusbCtrl_device_t m_handle = nullptr;
+};
+
+/**
+ * @brief Range over the devices connected at the time each step is taken.
+ *
+ * Iteration walks the library's device list in ID order one reference at a time; no list is copied.
+ * Devices inserted during iteration are visited if their ID is ahead of the iterator.
+ */
+class connected_devices
+{
+	public:
+	class iterator
+	{
+		public:
+		iterator() noexcept = default;
+		explicit iterator(device current) noexcept : m_current(std::move(current)) {}
+
+		const device & operator*() const noexcept {return m_current;}
+		const device * operator->() const noexcept {return &m_current;}
+		iterator & operator++() noexcept
+		{
+			m_current = device::adopt(rusbCtrl_acquireNextDevice(m_current.id()));
+			return *this;
+		}
+		bool operator==(const iterator &other) const noexcept {return (m_current.native_handle() == other.m_current.native_handle());}
+		bool operator!=(const iterator &other) const noexcept {return !(*this == other);}
+
+		private:
+		device m_current;
+	};
+
+	iterator begin() const noexcept {return iterator(device::adopt(rusbCtrl_acquireNextDevice(0)));}
+	iterator end() const noexcept {return iterator();}
+};
+
+inline connected_devices devices() noexcept {return connected_devices();}
+
+/**
+ * @brief Keeps a handler registered for insert/remove events for as long as the object exists.
+ *
+ * The handler runs on the library's monitor thread. When a subscription is destroyed or reset on another
+ * thread, it waits for a handler call in progress; see rusbCtrl_removeListener(). Handlers must not throw.
+ */
+class subscription
+{
+	public:
+	typedef std::function<void(int devId, bool inserted)> handler;
+
+	subscription() noexcept = default;
+	explicit subscription(handler callback) : m_handler(new handler(std::move(callback)))
+	{
+		if(RUSBCTRL_SUCCESS != rusbCtrl_addListener(&subscription::trampoline, m_handler.get(), &m_listener))
+		{
+			m_handler.reset();
+		}
+	}
+	subscription(subscription &&other) noexcept : m_handler(std::move(other.m_handler)), m_listener(other.m_listener) {}
+	subscription & operator=(subscription &&other) noexcept
+	{
+		if(this != &other)
+		{
+			reset();
+			m_handler = std::move(other.m_handler);
+			m_listener = other.m_listener;
+		}
+		return *this;
+	}
+	subscription(const subscription &) = delete;
+	subscription & operator=(const subscription &) = delete;
+	~subscription() {reset();}
+
+	explicit operator bool() const noexcept {return static_cast<bool>(m_handler);}
+
+	void reset() noexcept
+	{
+		if(m_handler)
+		{
+			rusbCtrl_removeListener(m_listener);
+			m_handler.reset();
+		}
+	}
+
+	private:
+	static void trampoline(int devId, int inserted, void *data) noexcept
+	{
+		(*static_cast<handler *>(data))(devId, (0 != inserted));
+	}
+
+	/* Heap-allocated so that its address, which the library holds as cbData, survives moves. */
+	std::unique_ptr<handler> m_handler;
+	int m_listener = 0;
+};
+
+inline subscription subscribe(subscription::handler callback) {return subscription(std::move(callback));}
+
+/**
+ * @brief Blocks until a matching device is connected. See rusbCtrl_waitForDevice().
+ *
+ * @return The device, or an empty device on timeout or failure.
+ */
+inline device wait_for_device(const rusbCtrl_deviceMatch_t &filter, int timeout_ms)
+{
+	int devId;
+	if(RUSBCTRL_SUCCESS != rusbCtrl_waitForDevice(&filter, timeout_ms, &devId))
+	{
+		return device();
+	}
+	return device(devId);
+}
+
+#ifdef USBCTRL_HAS_COROUTINES
+/**
+ * @brief C++20 awaitable that completes on the next insertion of a device matching the filter.
+ *
+ * @code
+ * usbctrl::device dongle = co_await usbctrl::next_event(filter);
+ * @endcode
+ *
+ * Only devices inserted after the co_await are considered. The coroutine is resumed on the library's
+ * monitor thread, so it should hand anything lengthy over to its own executor. The filter, including
+ * its serial string, must stay valid until the co_await completes. The result is empty if the device
+ * was removed again before it could be referenced.
+ */
+class next_event
+{
+	public:
+	explicit next_event(const rusbCtrl_deviceMatch_t &filter) noexcept : m_filter(filter) {}
+	next_event(const next_event &) = delete;
+	next_event & operator=(const next_event &) = delete;
+	~next_event()
+	{
+		/* Only reached with a live listener if the suspended coroutine is destroyed without being resumed. */
+		if((0 != m_listener) && !m_fired)
+		{
+			rusbCtrl_removeListener(m_listener);
+		}
+	}
+
+	bool await_ready() const noexcept {return false;}
+	bool await_suspend(std::coroutine_handle<> waiter) noexcept
+	{
+		m_waiter = waiter;
+		/* The event may fire on the monitor thread before this returns; nothing here touches *this afterwards. */
+		return (RUSBCTRL_SUCCESS == rusbCtrl_addListener(&next_event::on_event, this, &m_listener));
+	}
+	device await_resume() noexcept {return std::move(m_device);}
+
+	private:
+	static void on_event(int devId, int inserted, void *data) noexcept
+	{
+		next_event *self = static_cast<next_event *>(data);
+		if((0 == inserted) || self->m_fired || (RUSBCTRL_SUCCESS != rusbCtrl_matchDevice(devId, &self->m_filter)))
+		{
+			return;
+		}
+		self->m_fired = true;
+		self->m_device = device(devId);
+		rusbCtrl_removeListener(self->m_listener);
+		/* The listener runs with the dispatch lock held; resume only once the dispatch has released it. */
+		rusbCtrl_runAfterDispatch(&next_event::resume_waiter, self);
+	}
+
+	static void resume_waiter(void *data) noexcept
+	{
+		static_cast<next_event *>(data)->m_waiter.resume();
+	}
+
+	rusbCtrl_deviceMatch_t m_filter;
+	std::coroutine_handle<> m_waiter;
+	device m_device;
+	int m_listener = 0;
+	bool m_fired = false;
+};
+#endif
+
+/** @} */  //END OF GROUP USB_CNTRL_CXX
+
+} // namespace usbctrl
+
+#endif /* _USBCTRL_HPP_ */
@@ -18,6 +18,9 @@
 */
 #include "libudev.h"
 #include "usbctrl.h"
+#include "usbctrl_log.h"
+#include "usbctrl_prefetch.h"
+#include "usbctrl_descriptors.h"
 #include <iostream>
 #include <stdio.h>
 #include <list>
@@ -26,22 +29,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
-
-//#define ENABLE_DEBUG 1
-#define LOG(level, text, ...) do {\
-    printf("%s[%d] - %s: " text, __FUNCTION__, __LINE__, level, ##__VA_ARGS__);}while(0);
-
-#define ERROR(text, ...) do {\
-    printf("%s[%d] - %s: " text, __FUNCTION__, __LINE__, "ERROR", ##__VA_ARGS__);}while(0);
-#define INFO(text, ...) do {\
-    printf("%s[%d] - %s: " text, __FUNCTION__, __LINE__, "INFO", ##__VA_ARGS__);}while(0);
-
-#ifdef ENABLE_DEBUG
-#define DEBUG(text, ...) do {\
-    printf("%s[%d] - %s: " text, __FUNCTION__, __LINE__, "DEBUG", ##__VA_ARGS__);}while(0);
-#else
-#define DEBUG(text, ...)
-#endif
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <errno.h>
 
 #define REPORT_IF_UNEQUAL(lhs, rhs) do {\
     if((lhs) != (rhs)) ERROR("Unexpected error!\n");}while(0);
@@ -52,8 +47,14 @@ static const suseconds_t MONITOR_TIMEOUT_USECS = 250000;
 static const int PIPE_READ_FD = 0;
 static const int PIPE_WRITE_FD = 1;
 static const int CONTROL_MESSAGE_SIZE = 4;
+static const int CONTROL_MESSAGE_RESCAN = 1;
+static const size_t MAX_PENDING_ARRIVALS = 64;
+static const uint8_t USB_CLASS_HUB = 0x09;
+static const size_t ATTRIBUTE_READ_SIZE = 512;
+static const size_t DESCRIPTORS_READ_SIZE = 4096;
 
-const char * supported_property_list[] = 
+/* Indexed by rusbCtrl_propname_t. */
+static constexpr const char * supported_property_list[] =
 	{
 		"manufacturer",
 		"product",
@@ -61,35 +62,598 @@ const char * supported_property_list[] =
 		"idVendor",
 		"serial",
 		"bInterfaceClass",
-		"bInterfaceSubClass"
+		"bInterfaceSubClass",
+		"bDeviceClass",
+		"bDeviceSubClass",
+		"speed",
+		"busnum",
+		"devnum"
 	};
+static constexpr int SUPPORTED_PROPERTY_COUNT = sizeof(supported_property_list) / sizeof(supported_property_list[0]);
+static_assert(SUPPORTED_PROPERTY_COUNT == (RUSBCTRL_PROPNAME_DEVNUM + 1), "supported_property_list is out of sync with rusbCtrl_propname_t");
+
+/* Property name to rusbCtrl_propname_t lookup. The hash (length + second char + last char) is collision-free over
+ * supported_property_list, which is verified at compile time, so a lookup costs one hash and one strcmp. */
+static constexpr unsigned int PROPERTY_HASH_SLOTS = 32;
+
+static constexpr size_t property_name_length(const char *name)
+{
+	return ('\0' == *name) ? 0 : (1 + property_name_length(name + 1));
+}
+static constexpr unsigned int property_hash(const char *name, size_t length)
+{
+	return (length < 2) ? 0 : ((length + (unsigned char)name[1] + (unsigned char)name[length - 1]) & (PROPERTY_HASH_SLOTS - 1));
+}
+static constexpr int property_slot_owner(unsigned int slot, int index = 0)
+{
+	return (SUPPORTED_PROPERTY_COUNT == index) ? -1 :
+		((slot == property_hash(supported_property_list[index], property_name_length(supported_property_list[index]))) ?
+		 index : property_slot_owner(slot, index + 1));
+}
+static constexpr bool property_hash_is_perfect(int index = 0)
+{
+	return (SUPPORTED_PROPERTY_COUNT == index) ||
+		((index == property_slot_owner(property_hash(supported_property_list[index], property_name_length(supported_property_list[index])))) &&
+		 property_hash_is_perfect(index + 1));
+}
+static_assert(property_hash_is_perfect(), "property_hash() collides on supported_property_list; pick new hash inputs");
+
+#define PROPERTY_SLOTS_4(n) property_slot_owner(n), property_slot_owner(n + 1), property_slot_owner(n + 2), property_slot_owner(n + 3)
+#define PROPERTY_SLOTS_16(n) PROPERTY_SLOTS_4(n), PROPERTY_SLOTS_4(n + 4), PROPERTY_SLOTS_4(n + 8), PROPERTY_SLOTS_4(n + 12)
+static constexpr int property_slots[PROPERTY_HASH_SLOTS] = {PROPERTY_SLOTS_16(0), PROPERTY_SLOTS_16(16)};
+#undef PROPERTY_SLOTS_16
+#undef PROPERTY_SLOTS_4
+
+/* Returns the rusbCtrl_propname_t for name, or -1 if it is not a supported property. */
+static inline int lookup_property(const char *name)
+{
+	size_t length = strlen(name);
+	int index = property_slots[property_hash(name, length)];
+	if((0 <= index) && (0 == strcmp(name, supported_property_list[index])))
+	{
+		return index;
+	}
+	return -1;
+}
+
+/* What a rusbCtrl_deviceMatch_t is compared against. */
+struct device_subject
+{
+	uint16_t vendor_id;
+	uint16_t product_id;
+	uint8_t device_class;
+	const char *serial;
+	std::vector<uint8_t> interface_classes;
+};
+
+/* A serial match needs a serial to compare against. */
+static bool is_valid_match(const rusbCtrl_deviceMatch_t *match)
+{
+	return ((NULL != match) && (!(match->flags & RUSBCTRL_MATCH_SERIAL) || (NULL != match->serial)));
+}
+
+static bool device_matches(const rusbCtrl_deviceMatch_t &match, const char *serial, const device_subject &subject)
+{
+	if((match.flags & RUSBCTRL_MATCH_VENDOR) && (match.vendorId != subject.vendor_id))
+	{
+		return false;
+	}
+	if((match.flags & RUSBCTRL_MATCH_PRODUCT) && (match.productId != subject.product_id))
+	{
+		return false;
+	}
+	if((match.flags & RUSBCTRL_MATCH_SERIAL) && ((NULL == serial) || (NULL == subject.serial) || (0 != strcmp(serial, subject.serial))))
+	{
+		return false;
+	}
+	if((match.flags & RUSBCTRL_MATCH_CLASS) && (match.deviceClass != subject.device_class))
+	{
+		size_t i;
+		for(i = 0; i < subject.interface_classes.size(); i++)
+		{
+			if(match.deviceClass == subject.interface_classes[i])
+			{
+				break;
+			}
+		}
+		if(i == subject.interface_classes.size())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Interfaces show up as children named "<bus>-<port>:<config>.<interface>" under the device's syspath. */
+static void read_interface_classes(const char *syspath, std::vector<uint8_t> &classes)
+{
+	if(NULL == syspath)
+	{
+		return;
+	}
+	DIR *dir = opendir(syspath);
+	if(NULL == dir)
+	{
+		return;
+	}
+	struct dirent *entry;
+	while(NULL != (entry = readdir(dir)))
+	{
+		if(NULL == strchr(entry->d_name, ':'))
+		{
+			continue;
+		}
+		std::string path = std::string(syspath) + "/" + entry->d_name + "/bInterfaceClass";
+		char buffer[8] = {0};
+		int fd = open(path.c_str(), O_RDONLY);
+		if(0 <= fd)
+		{
+			if(0 < read(fd, buffer, sizeof(buffer) - 1))
+			{
+				classes.push_back((uint8_t)strtoul(buffer, NULL, 16));
+			}
+			close(fd);
+		}
+	}
+	closedir(dir);
+}
+
+static unsigned long usecs_since(const struct timespec &start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long)((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000L);
+}
 
 class device_manager
 {
 	public :
 	class device_record
 	{
+		public:
+		struct numeric_properties
+		{
+			uint16_t vendor_id;
+			uint16_t product_id;
+			uint8_t device_class;
+			uint8_t device_subclass;
+			uint32_t speed_kbps;
+			uint16_t busnum;
+			uint16_t devnum;
+		};
+
 		private:
 		int m_identifier;
 		struct udev_device *m_device;
 		const char* m_devnode;
+		/* Supported properties are read from sysfs once, when the record is created. */
+		std::string m_properties[SUPPORTED_PROPERTY_COUNT];
+		bool m_property_present[SUPPORTED_PROPERTY_COUNT];
+		numeric_properties m_numeric;
+		std::vector<uint8_t> m_interface_classes;
+		usb_descriptors m_descriptors;
+		/* One reference belongs to m_device_records, one to each rusbCtrl_device_t handed out. Cached properties are
+		 * immutable after construction, so a handle can read them without the record lock. */
+		std::atomic<int> m_references;
 
-		public:
-		device_record(int identifier, struct udev_device * device, const char* devnode) : 
-			m_identifier(identifier), m_device(device), m_devnode(devnode)
-		{
-			DEBUG("adding device 0x%x, %s\n", (unsigned int)m_device, m_devnode);
-		}
 		~device_record()
 		{
 			/* The udev_device entry needs to be unreffed when the device is removed.*/
-			DEBUG("Unreffing device 0x%x, %s\n", (unsigned int)m_device, m_devnode);
+			DEBUG("Unreffing device %p, %s\n", m_device, m_devnode);
 			udev_device_unref(m_device);
 		}
+
+		public:
+		/* The identifier is assigned by set_identifier() once the record is published. */
+		device_record(struct udev_device * device, const char* devnode, const prefetch_request *attributes) : 
+			m_identifier(0), m_device(device), m_devnode(devnode), m_references(1)
+		{
+			DEBUG("adding device %p, %s\n", m_device, m_devnode);
+			cache_properties(attributes);
+		}
+
+		/* Queues the sysfs reads that the constructor expects, in the order in which it consumes them. */
+		static void add_prefetch_requests(const char *syspath, std::vector<prefetch_request> &requests)
+		{
+			std::string prefix = std::string(syspath) + "/";
+			requests.push_back(prefetch_request(prefix + "descriptors", DESCRIPTORS_READ_SIZE));
+			for(int i = 0; i < SUPPORTED_PROPERTY_COUNT; i++)
+			{
+				if(!derived_from_descriptor(i) && !interface_level(i))
+				{
+					requests.push_back(prefetch_request(prefix + supported_property_list[i], ATTRIBUTE_READ_SIZE));
+				}
+			}
+		}
+		inline void acquire() {m_references.fetch_add(1, std::memory_order_relaxed);}
+		static void release(device_record *record)
+		{
+			if(1 == record->m_references.fetch_sub(1, std::memory_order_acq_rel))
+			{
+				delete record;
+			}
+		}
 		inline struct udev_device* get_device() {return m_device;}
 		inline int get_identifier() {return m_identifier;}
+		inline void set_identifier(int identifier) {m_identifier = identifier;}
 		inline const char * get_devnode() {return m_devnode;}
+		inline const numeric_properties & get_numeric_properties() {return m_numeric;}
+		inline bool has_property(int property) {return m_property_present[property];}
+		inline const std::string & get_property(int property) {return m_properties[property];}
+		inline const usb_descriptors & get_descriptors() {return m_descriptors;}
+		void get_subject(device_subject &subject, bool with_interface_classes)
+		{
+			subject.vendor_id = m_numeric.vendor_id;
+			subject.product_id = m_numeric.product_id;
+			subject.device_class = m_numeric.device_class;
+			subject.serial = (m_property_present[RUSBCTRL_PROPNAME_SERIAL] ? m_properties[RUSBCTRL_PROPNAME_SERIAL].c_str() : NULL);
+			if(with_interface_classes)
+			{
+				subject.interface_classes = m_interface_classes;
+			}
+		}
+		bool matches(const rusbCtrl_deviceMatch_t &match)
+		{
+			device_subject subject;
+			get_subject(subject, (0 != (match.flags & RUSBCTRL_MATCH_CLASS)));
+			return device_matches(match, match.serial, subject);
+		}
+		bool get_numeric_property(int property, uint32_t &value)
+		{
+			switch(property)
+			{
+				case RUSBCTRL_PROPNAME_VENDOR: value = m_numeric.vendor_id; break;
+				case RUSBCTRL_PROPNAME_MODEL: value = m_numeric.product_id; break;
+				case RUSBCTRL_PROPNAME_DEVCLASS: value = m_numeric.device_class; break;
+				case RUSBCTRL_PROPNAME_DEVSUBCLASS: value = m_numeric.device_subclass; break;
+				case RUSBCTRL_PROPNAME_SPEED: value = m_numeric.speed_kbps; break;
+				case RUSBCTRL_PROPNAME_BUSNUM: value = m_numeric.busnum; break;
+				case RUSBCTRL_PROPNAME_DEVNUM: value = m_numeric.devnum; break;
+				default: return false;
+			}
+			return m_property_present[property];
+		}
+
+		private:
+		/* attributes, if not NULL, comes from add_prefetch_requests(). Attributes it found missing (ENOENT) are absent;
+		 * those it could not read for any other reason are read through libudev. */
+		void cache_properties(const prefetch_request *attributes)
+		{
+			if(NULL != attributes)
+			{
+				if(attributes->present)
+				{
+					m_descriptors.parse((const uint8_t *)attributes->value.data(), attributes->value.size());
+				}
+				attributes++;
+			}
+			for(int i = 0; i < SUPPORTED_PROPERTY_COUNT; i++)
+			{
+				if(interface_level(i))
+				{
+					m_property_present[i] = false;
+					m_properties[i].clear();
+					continue;
+				}
+				if(!derived_from_descriptor(i) && (NULL != attributes))
+				{
+					const prefetch_request *attribute = attributes++;
+					if((!attribute->present) && (ENOENT == attribute->error))
+					{
+						m_property_present[i] = false;
+						m_properties[i].clear();
+						continue;
+					}
+					if(attribute->present)
+					{
+						m_property_present[i] = true;
+						m_properties[i] = attribute->value;
+						/* Like libudev, drop the newline. */
+						while(!m_properties[i].empty() && ('\n' == m_properties[i].back()))
+						{
+							m_properties[i].pop_back();
+						}
+						continue;
+					}
+				}
+				char buffer[8];
+				const char *value = (m_descriptors.is_valid() ? format_from_descriptor(i, buffer, sizeof(buffer)) : NULL);
+				if(NULL == value)
+				{
+					value = udev_device_get_sysattr_value(m_device, supported_property_list[i]);
+				}
+				m_property_present[i] = (NULL != value);
+				m_properties[i] = (NULL != value ? value : "");
+			}
+			m_numeric.vendor_id = (uint16_t)strtoul(m_properties[RUSBCTRL_PROPNAME_VENDOR].c_str(), NULL, 16);
+			m_numeric.product_id = (uint16_t)strtoul(m_properties[RUSBCTRL_PROPNAME_MODEL].c_str(), NULL, 16);
+			m_numeric.device_class = (uint8_t)strtoul(m_properties[RUSBCTRL_PROPNAME_DEVCLASS].c_str(), NULL, 16);
+			m_numeric.device_subclass = (uint8_t)strtoul(m_properties[RUSBCTRL_PROPNAME_DEVSUBCLASS].c_str(), NULL, 16);
+			m_numeric.speed_kbps = parse_speed_kbps(m_properties[RUSBCTRL_PROPNAME_SPEED].c_str());
+			m_numeric.busnum = (uint16_t)strtoul(m_properties[RUSBCTRL_PROPNAME_BUSNUM].c_str(), NULL, 10);
+			m_numeric.devnum = (uint16_t)strtoul(m_properties[RUSBCTRL_PROPNAME_DEVNUM].c_str(), NULL, 10);
+			if(m_numeric.speed_kbps >= 5000000)
+			{
+				m_descriptors.set_super_speed();
+			}
+			if(m_descriptors.is_valid())
+			{
+				m_descriptors.get_interface_classes(m_interface_classes);
+			}
+			else if(NULL != m_device)
+			{
+				read_interface_classes(udev_device_get_syspath(m_device), m_interface_classes);
+			}
+		}
+
+		/* sysfs reports speed in Mbit/s, with "1.5" for low speed. strtod() would follow the locale's decimal point, so the
+		 * integer and fractional parts are parsed separately. */
+		static uint32_t parse_speed_kbps(const char *speed)
+		{
+			char *end;
+			uint32_t kbps = (uint32_t)strtoul(speed, &end, 10) * 1000;
+			if('.' == *end)
+			{
+				uint32_t scale = 100;
+				for(const char *digit = end + 1; (0 < scale) && ('0' <= *digit) && ('9' >= *digit); digit++, scale /= 10)
+				{
+					kbps += (*digit - '0') * scale;
+				}
+			}
+			return kbps;
+		}
+
+		/* The device descriptor answers the id and class properties, saving a sysfs read for each. */
+		static bool derived_from_descriptor(int property)
+		{
+			return ((RUSBCTRL_PROPNAME_VENDOR == property) || (RUSBCTRL_PROPNAME_MODEL == property) ||
+				(RUSBCTRL_PROPNAME_DEVCLASS == property) || (RUSBCTRL_PROPNAME_DEVSUBCLASS == property));
+		}
+
+		/* Records are usb_device nodes, which never carry the interface attributes; those live on their interfaces. */
+		static bool interface_level(int property)
+		{
+			return ((RUSBCTRL_PROPNAME_DEVTYPE == property) || (RUSBCTRL_PROPNAME_DEVSUBTYPE == property));
+		}
+
+		/* Formats a property the way sysfs does, if the device descriptor has it. */
+		const char * format_from_descriptor(int property, char *buffer, size_t size)
+		{
+			const rusbCtrl_deviceDescriptor_t &device = m_descriptors.get_device();
+			switch(property)
+			{
+				case RUSBCTRL_PROPNAME_VENDOR: snprintf(buffer, size, "%04x", device.vendorId); break;
+				case RUSBCTRL_PROPNAME_MODEL: snprintf(buffer, size, "%04x", device.productId); break;
+				case RUSBCTRL_PROPNAME_DEVCLASS: snprintf(buffer, size, "%02x", device.deviceClass); break;
+				case RUSBCTRL_PROPNAME_DEVSUBCLASS: snprintf(buffer, size, "%02x", device.deviceSubClass); break;
+				default: return NULL;
+			}
+			return buffer;
+		}
+
+	};
+
+	class policy_engine
+	{
+		private:
+		struct policy_rule
+		{
+			rusbCtrl_deviceMatch_t match;
+			std::string serial;
+			rusbCtrl_policyAction_t action;
+		};
+
+		typedef std::unordered_map<uint32_t, std::vector<size_t> > rule_index;
+
+		pthread_mutex_t m_mutex;
+		std::vector<policy_rule> m_rules;
+		/* Compiled matcher. Rules that pin vendor and product are hashed on both, rules that pin only the vendor
+		 * are hashed on the vendor and everything else is scanned. Each bucket holds rule positions in ascending
+		 * order, so the first matching rule still wins. */
+		rule_index m_vendor_product_index;
+		rule_index m_vendor_index;
+		std::vector<size_t> m_unindexed_rules;
+		bool m_has_class_rules;
+		rusbCtrl_policyAction_t m_default_action;
+		rusbCtrl_stats_t m_stats;
+
+		public:
+		policy_engine() : m_has_class_rules(false), m_default_action(RUSBCTRL_POLICY_ALLOW)
+		{
+			REPORT_IF_UNEQUAL(0, pthread_mutex_init(&m_mutex, NULL));
+			memset(&m_stats, 0, sizeof(m_stats));
+		}
+		~policy_engine()
+		{
+			pthread_mutex_destroy(&m_mutex);
+		}
+
+		rusbCtrl_result_t add_rule(const rusbCtrl_deviceMatch_t *match, rusbCtrl_policyAction_t action)
+		{
+			if(!is_valid_match(match))
+			{
+				ERROR("Invalid policy rule.\n");
+				return RUSBCTRL_FAILURE;
+			}
+			policy_rule rule;
+			rule.match = *match;
+			rule.serial = ((match->flags & RUSBCTRL_MATCH_SERIAL) ? match->serial : "");
+			rule.match.serial = NULL;
+			rule.action = action;
+
+			REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));
+			m_rules.push_back(rule);
+			compile_rules();
+			REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+			INFO("Added %s rule (flags 0x%x, %04x:%04x, class 0x%02x).\n", (RUSBCTRL_POLICY_DENY == action ? "deny" : "allow"),
+				match->flags, match->vendorId, match->productId, match->deviceClass);
+			return RUSBCTRL_SUCCESS;
+		}
+
+		rusbCtrl_result_t set_default_action(rusbCtrl_policyAction_t action)
+		{
+			REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));
+			m_default_action = action;
+			REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+			return RUSBCTRL_SUCCESS;
+		}
+
+		rusbCtrl_result_t clear_rules()
+		{
+			REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));
+			m_rules.clear();
+			compile_rules();
+			m_default_action = RUSBCTRL_POLICY_ALLOW;
+			REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+			return RUSBCTRL_SUCCESS;
+		}
+
+		void get_stats(rusbCtrl_stats_t *stats)
+		{
+			REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));
+			stats->policyDecisions = m_stats.policyDecisions;
+			stats->policyDenied = m_stats.policyDenied;
+			stats->policyLastDecisionUsecs = m_stats.policyLastDecisionUsecs;
+			stats->policyMaxDecisionUsecs = m_stats.policyMaxDecisionUsecs;
+			stats->policyTotalDecisionUsecs = m_stats.policyTotalDecisionUsecs;
+			REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+		}
+
+		/* Runs for every 'add' event on the monitor thread and for every device found by enumeration, once its record has
+		 * been read but before it is published. Returns false if the device was de-authorized. */
+		bool evaluate(device_record &record, const struct timespec &arrival)
+		{
+			bool authorized = true;
+			REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));
+			if(m_rules.empty() && (RUSBCTRL_POLICY_ALLOW == m_default_action))
+			{
+				REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+				return true;
+			}
+			/* De-authorizing a hub, root hubs included, would take down everything behind it. */
+			if(USB_CLASS_HUB == record.get_numeric_properties().device_class)
+			{
+				REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+				DEBUG("Hub %s is exempt from the policy.\n", udev_device_get_syspath(record.get_device()));
+				return true;
+			}
+
+			/* The record already holds the parsed descriptors and the serial, so deciding needs no sysfs read. Interface
+			 * classes are only copied when a class rule exists. */
+			device_subject subject;
+			record.get_subject(subject, m_has_class_rules);
+
+			const policy_rule *rule = find_first_match(subject);
+			rusbCtrl_policyAction_t action = (NULL != rule ? rule->action : m_default_action);
+			authorized = (RUSBCTRL_POLICY_ALLOW == action);
+			write_authorized(udev_device_get_syspath(record.get_device()), authorized);
+
+			unsigned long latency = usecs_since(arrival);
+			m_stats.policyDecisions++;
+			m_stats.policyLastDecisionUsecs = latency;
+			m_stats.policyTotalDecisionUsecs += latency;
+			if(latency > m_stats.policyMaxDecisionUsecs)
+			{
+				m_stats.policyMaxDecisionUsecs = latency;
+			}
+			if(!authorized)
+			{
+				m_stats.policyDenied++;
+			}
+			REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+			INFO("Device %04x:%04x %s in %luus.\n", subject.vendor_id, subject.product_id,
+				(authorized ? "authorized" : "de-authorized"), latency);
+			return authorized;
+		}
+
+		private:
+		static inline uint32_t vendor_product_key(uint16_t vendor, uint16_t product)
+		{
+			return (((uint32_t)vendor << 16) | product);
+		}
+
+		void compile_rules() //needs lock
+		{
+			m_vendor_product_index.clear();
+			m_vendor_index.clear();
+			m_unindexed_rules.clear();
+			m_has_class_rules = false;
+			for(size_t i = 0; i < m_rules.size(); i++)
+			{
+				const rusbCtrl_deviceMatch_t &match = m_rules[i].match;
+				if((match.flags & RUSBCTRL_MATCH_VENDOR) && (match.flags & RUSBCTRL_MATCH_PRODUCT))
+				{
+					m_vendor_product_index[vendor_product_key(match.vendorId, match.productId)].push_back(i);
+				}
+				else if(match.flags & RUSBCTRL_MATCH_VENDOR)
+				{
+					m_vendor_index[match.vendorId].push_back(i);
+				}
+				else
+				{
+					m_unindexed_rules.push_back(i);
+				}
+				if(match.flags & RUSBCTRL_MATCH_CLASS)
+				{
+					m_has_class_rules = true;
+				}
+			}
+		}
+
+		/* Candidates come from the two hash buckets and the unindexed list; the lowest matching position wins. */
+		const policy_rule * find_first_match(const device_subject &subject) //needs lock
+		{
+			const std::vector<size_t> *candidates[3] = {&m_unindexed_rules, NULL, NULL};
+			rule_index::const_iterator bucket = m_vendor_product_index.find(vendor_product_key(subject.vendor_id, subject.product_id));
+			if(bucket != m_vendor_product_index.end())
+			{
+				candidates[1] = &bucket->second;
+			}
+			bucket = m_vendor_index.find(subject.vendor_id);
+			if(bucket != m_vendor_index.end())
+			{
+				candidates[2] = &bucket->second;
+			}
+
+			size_t first = m_rules.size();
+			for(int c = 0; c < 3; c++)
+			{
+				if(NULL == candidates[c])
+				{
+					continue;
+				}
+				for(size_t i = 0; (i < candidates[c]->size()) && ((*candidates[c])[i] < first); i++)
+				{
+					if(device_matches(m_rules[(*candidates[c])[i]].match, m_rules[(*candidates[c])[i]].serial.c_str(), subject))
+					{
+						first = (*candidates[c])[i];
+						break;
+					}
+				}
+			}
+			return (first < m_rules.size() ? &m_rules[first] : NULL);
+		}
 
+		static void write_authorized(const char *syspath, bool authorized)
+		{
+			if(NULL == syspath)
+			{
+				ERROR("No syspath. Cannot apply policy.\n");
+				return;
+			}
+			std::string path = std::string(syspath) + "/authorized";
+			int fd = open(path.c_str(), O_WRONLY);
+			if(0 > fd)
+			{
+				ERROR("Could not open %s.\n", path.c_str());
+				return;
+			}
+			if(1 != write(fd, (authorized ? "1" : "0"), 1))
+			{
+				ERROR("Could not write %s.\n", path.c_str());
+			}
+			close(fd);
+		}
 	};
 
 	private:
@@ -99,18 +663,56 @@ class device_manager
 	void * m_callback_data;
 	struct udev *m_udev_context;
 	int m_last_used_identifier;
-	bool m_enable_monitoring;
+	std::atomic<bool> m_enable_monitoring;
 	pthread_t m_monitor_thread;
 	struct udev_monitor * m_monitor;
 	int m_control_pipe[2];
+	policy_engine m_policy;
+	std::atomic<unsigned long> m_lock_acquisitions;
+	std::atomic<unsigned long> m_lock_contentions;
+
+	struct listener
+	{
+		int identifier;
+		rusbCtrl_devCallback_t callback;
+		void * callback_data;
+	};
+	/* Listeners are guarded by m_dispatch_mutex, which is held for the whole dispatch. remove_listener() therefore
+	 * waits for a dispatch in progress on another thread; on the dispatching thread itself the mutex is recursive
+	 * and the entry is only marked dead, then swept once the outermost dispatch is done. */
+	std::list<listener> m_listeners;
+	/* Queued by run_after_dispatch() during a dispatch, and run by the dispatching thread once it has unlocked. */
+	std::vector<std::pair<rusbCtrl_deferredCall_t, void *> > m_deferred_calls;
+	pthread_mutex_t m_dispatch_mutex;
+	int m_dispatch_depth;
+	int m_last_used_listener;
+	/* Signalled, with m_mutex held, whenever a record is added. */
+	pthread_cond_t m_device_added;
+
+	/* Early notification. The kernel monitor is created on first use and kept until the manager is destroyed;
+	 * the event callback and the pending arrivals (keyed by syspath) are guarded by m_mutex. */
+	std::atomic<struct udev_monitor *> m_kernel_monitor;
+	rusbCtrl_eventCallback_t m_event_callback;
+	void * m_event_callback_data;
+	std::unordered_map<std::string, struct timespec> m_pending_arrivals;
+	/* Early notification and enumeration statistics, guarded by m_mutex. */
+	rusbCtrl_stats_t m_stats;
 
 	public:
-	device_manager() : m_enable_monitoring(false), m_callback(NULL), m_last_used_identifier(0), m_monitor_thread(0)
+	device_manager() : m_enable_monitoring(false), m_callback(NULL), m_last_used_identifier(0), m_monitor_thread(0),
+		m_lock_acquisitions(0), m_lock_contentions(0), m_dispatch_depth(0), m_last_used_listener(0), m_kernel_monitor(NULL),
+		m_event_callback(NULL), m_event_callback_data(NULL)
 	{
+		memset(&m_stats, 0, sizeof(m_stats));
 		pthread_mutexattr_t mutex_attribute;
 		REPORT_IF_UNEQUAL(0, pthread_mutexattr_init(&mutex_attribute));
 		REPORT_IF_UNEQUAL(0, pthread_mutexattr_settype(&mutex_attribute, PTHREAD_MUTEX_RECURSIVE));
 		REPORT_IF_UNEQUAL(0, pthread_mutex_init(&m_mutex, &mutex_attribute));
+		REPORT_IF_UNEQUAL(0, pthread_mutex_init(&m_dispatch_mutex, &mutex_attribute));
+		pthread_condattr_t condition_attribute;
+		REPORT_IF_UNEQUAL(0, pthread_condattr_init(&condition_attribute));
+		REPORT_IF_UNEQUAL(0, pthread_condattr_setclock(&condition_attribute, CLOCK_MONOTONIC));
+		REPORT_IF_UNEQUAL(0, pthread_cond_init(&m_device_added, &condition_attribute));
 
 		INFO("Creating new device manager object.\n");
 		m_udev_context = udev_new();
@@ -120,8 +722,8 @@ class device_manager
 		}
 		else
 		{
-			INFO("Successfully created device manager object 0x%x with udev context 0x%x.\n",
-				(unsigned int)this, (unsigned int)m_udev_context);
+			INFO("Successfully created device manager object %p with udev context %p.\n",
+				this, m_udev_context);
 		}
 
 		/* Set up event monitoring. */		
@@ -191,16 +793,23 @@ class device_manager
 		{
 			udev_monitor_unref(m_monitor);
 		}
+		if(NULL != m_kernel_monitor.load())
+		{
+			udev_monitor_unref(m_kernel_monitor.load());
+		}
 
 		INFO("Destroying device manager object.\n");
 		udev_unref(m_udev_context);
 		pthread_mutex_destroy(&m_mutex);
+		pthread_mutex_destroy(&m_dispatch_mutex);
+		pthread_cond_destroy(&m_device_added);
 		INFO("Done.\n");
 	}
 	static void * monitor_thread_wrapper(void* data)
 	{
 		device_manager *obj = (device_manager *)data;
 		obj->monitor_for_changes();
+		return NULL;
 	}
 	rusbCtrl_result_t init()
 	{
@@ -210,71 +819,382 @@ class device_manager
 		return RUSBCTRL_SUCCESS;
 	}
 
-	rusbCtrl_result_t term()
+	rusbCtrl_result_t term()
+	{
+		INFO("Enter\n");
+		INFO("Clearing device records.\n");
+		lock_records();
+		reset_device_records();	
+		m_callback = NULL;
+		m_callback_data = NULL;
+		unlock_records();
+		INFO("Done.\n");
+		return RUSBCTRL_SUCCESS;
+	}
+	
+
+	char * get_property(int identifier, const char *key)
+	{
+		/* Find matching entry in the record*/
+		char * user_buffer = NULL;
+		lock_records();
+		device_record *record = find_record(identifier);
+		if(NULL != record)
+		{
+			DEBUG("Found record with identifer 0x%x. Querying...\n", identifier);
+			const char * value = NULL;
+			int property = lookup_property(key);
+			if(0 <= property)
+			{
+				value = (record->has_property(property) ? record->get_property(property).c_str() : NULL);
+			}
+			else
+			{
+				/* Not one of ours; let sysfs answer. */
+				value = udev_device_get_sysattr_value(record->get_device(), key);
+			}
+			if(NULL != value)
+			{
+				/* Copy before unlocking; the record may be deleted as soon as the lock is released. */
+				user_buffer = strdup(value); //Will be freed by user
+			}
+		}
+		unlock_records();
+		if(NULL == record)
+		{
+			ERROR("Found no record for device with id 0x%x\n", identifier);
+		}
+		else if(NULL == user_buffer)
+		{
+			ERROR("Could not find property %s.\n", key);
+		}
+		return user_buffer;
+	}
+
+	rusbCtrl_result_t get_numeric_property(int identifier, rusbCtrl_propname_t property, device_record::numeric_properties &value)
+	{
+		rusbCtrl_result_t result = RUSBCTRL_FAILURE;
+		lock_records();
+		device_record *record = find_record(identifier);
+		if((NULL != record) && (record->has_property(property)))
+		{
+			value = record->get_numeric_properties();
+			result = RUSBCTRL_SUCCESS;
+		}
+		unlock_records();
+		if(RUSBCTRL_SUCCESS != result)
+		{
+			ERROR("No property %s for device with id 0x%x\n", supported_property_list[property], identifier);
+		}
+		return result;
+	}
+
+	int register_callback(rusbCtrl_devCallback_t callback, void* callback_data, int ** device_list, int * device_list_size)
+	{
+		//Note: device_list_size stands for the number of entries in the list, not the actual bytes
+		lock_records();
+		m_callback = callback;
+		m_callback_data = callback_data;
+		if((NULL != device_list) && (NULL != device_list_size))
+		{
+			get_connected_devices_list(device_list, device_list_size);	
+		}
+		else
+		{
+			ERROR("Empty pointers provided. Won't supply connected devices.\n");
+		}
+		unlock_records();
+		INFO("Success!\n");
+		return RUSBCTRL_SUCCESS;
+	}
+
+	inline policy_engine & get_policy() {return m_policy;}
+
+	rusbCtrl_result_t enable_early_notification(rusbCtrl_eventCallback_t callback, void *callback_data)
+	{
+		rusbCtrl_result_t result = RUSBCTRL_SUCCESS;
+		lock_records();
+		if((NULL != callback) && (NULL == m_kernel_monitor.load()))
+		{
+			result = create_kernel_monitor();
+		}
+		if(RUSBCTRL_SUCCESS == result)
+		{
+			m_event_callback = callback;
+			m_event_callback_data = callback_data;
+			if(NULL == callback)
+			{
+				m_pending_arrivals.clear();
+				/* Have the monitor thread close the kernel monitor. */
+				if(NULL != m_kernel_monitor.load())
+				{
+					request_rescan();
+				}
+			}
+		}
+		unlock_records();
+		INFO("Early notification %s.\n", (NULL != callback ? "enabled" : "disabled"));
+		return result;
+	}
+
+	int add_listener(rusbCtrl_devCallback_t callback, void *callback_data, int *listener_identifier)
+	{
+		if((NULL == callback) || (NULL == listener_identifier))
+		{
+			ERROR("Invalid listener.\n");
+			return RUSBCTRL_FAILURE;
+		}
+		REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_dispatch_mutex));
+		listener entry = {++m_last_used_listener, callback, callback_data};
+		m_listeners.push_back(entry);
+		*listener_identifier = entry.identifier;
+		REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_dispatch_mutex));
+		return RUSBCTRL_SUCCESS;
+	}
+
+	int remove_listener(int listener_identifier)
+	{
+		int result = RUSBCTRL_FAILURE;
+		REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_dispatch_mutex));
+		std::list<listener>::iterator iter;
+		for(iter = m_listeners.begin(); iter != m_listeners.end(); iter++)
+		{
+			if((listener_identifier == iter->identifier) && (NULL != iter->callback))
+			{
+				if(0 == m_dispatch_depth)
+				{
+					m_listeners.erase(iter);
+				}
+				else
+				{
+					iter->callback = NULL;
+				}
+				result = RUSBCTRL_SUCCESS;
+				break;
+			}
+		}
+		REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_dispatch_mutex));
+		return result;
+	}
+
+	int run_after_dispatch(rusbCtrl_deferredCall_t call, void *call_data)
+	{
+		if(NULL == call)
+		{
+			ERROR("Invalid deferred call.\n");
+			return RUSBCTRL_FAILURE;
+		}
+		/* Other threads block here until any dispatch is done, so a non-zero depth means this thread is dispatching. */
+		REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_dispatch_mutex));
+		bool dispatching = (0 != m_dispatch_depth);
+		if(dispatching)
+		{
+			m_deferred_calls.push_back(std::make_pair(call, call_data));
+		}
+		REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_dispatch_mutex));
+		if(!dispatching)
+		{
+			call(call_data);
+		}
+		return RUSBCTRL_SUCCESS;
+	}
+
+	rusbCtrl_result_t get_device_descriptor(int identifier, rusbCtrl_deviceDescriptor_t *descriptor)
+	{
+		rusbCtrl_result_t result = RUSBCTRL_FAILURE;
+		lock_records();
+		device_record *record = find_record(identifier);
+		if((NULL != record) && (record->get_descriptors().is_valid()))
+		{
+			*descriptor = record->get_descriptors().get_device();
+			result = RUSBCTRL_SUCCESS;
+		}
+		unlock_records();
+		return result;
+	}
+
+	rusbCtrl_result_t get_config_descriptor(int identifier, int config_index, rusbCtrl_configDescriptor_t *descriptor)
+	{
+		rusbCtrl_result_t result = RUSBCTRL_FAILURE;
+		lock_records();
+		device_record *record = find_record(identifier);
+		const usb_descriptors::config_info *config = (NULL != record ? record->get_descriptors().get_config(config_index) : NULL);
+		if(NULL != config)
+		{
+			*descriptor = config->descriptor;
+			result = RUSBCTRL_SUCCESS;
+		}
+		unlock_records();
+		return result;
+	}
+
+	rusbCtrl_result_t get_interface_descriptor(int identifier, int config_index, int interface_index, rusbCtrl_interfaceDescriptor_t *descriptor)
+	{
+		rusbCtrl_result_t result = RUSBCTRL_FAILURE;
+		lock_records();
+		device_record *record = find_record(identifier);
+		const usb_descriptors::interface_info *interface = (NULL != record ?
+			record->get_descriptors().get_interface(config_index, interface_index) : NULL);
+		if(NULL != interface)
+		{
+			*descriptor = interface->descriptor;
+			result = RUSBCTRL_SUCCESS;
+		}
+		unlock_records();
+		return result;
+	}
+
+	rusbCtrl_result_t get_endpoint_descriptor(int identifier, int config_index, int interface_index, int endpoint_index,
+			rusbCtrl_endpointDescriptor_t *descriptor)
+	{
+		rusbCtrl_result_t result = RUSBCTRL_FAILURE;
+		lock_records();
+		device_record *record = find_record(identifier);
+		const rusbCtrl_endpointDescriptor_t *endpoint = (NULL != record ?
+			record->get_descriptors().get_endpoint(config_index, interface_index, endpoint_index) : NULL);
+		if(NULL != endpoint)
+		{
+			*descriptor = *endpoint;
+			result = RUSBCTRL_SUCCESS;
+		}
+		unlock_records();
+		return result;
+	}
+
+	rusbCtrl_result_t match_device(int identifier, const rusbCtrl_deviceMatch_t *filter)
+	{
+		if(!is_valid_match(filter))
+		{
+			ERROR("Invalid filter.\n");
+			return RUSBCTRL_FAILURE;
+		}
+		rusbCtrl_result_t result = RUSBCTRL_FAILURE;
+		lock_records();
+		device_record *record = find_record(identifier);
+		if((NULL != record) && (record->matches(*filter)))
+		{
+			result = RUSBCTRL_SUCCESS;
+		}
+		unlock_records();
+		return result;
+	}
+
+	rusbCtrl_result_t wait_for_device(const rusbCtrl_deviceMatch_t *filter, int timeout_ms, int *identifier)
 	{
-		INFO("Enter\n");
-		INFO("Clearing device records.\n");
-		REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));
-		reset_device_records();	
-		m_callback = NULL;
-		m_callback_data = NULL;
-		REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
-		INFO("Done.\n");
-		return RUSBCTRL_SUCCESS;
-	}
-	
+		if((!is_valid_match(filter)) || (NULL == identifier))
+		{
+			ERROR("Invalid arguments.\n");
+			return RUSBCTRL_FAILURE;
+		}
+		if((0 != m_monitor_thread) && (0 != pthread_equal(pthread_self(), m_monitor_thread)))
+		{
+			/* Nothing would ever wake us up. */
+			ERROR("Cannot wait for a device from a callback.\n");
+			return RUSBCTRL_FAILURE;
+		}
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+		if(deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
 
-	char * get_property(int identifier, const char *key) //needs lock
-	{
-		/* Find matching entry in the record*/
-		std::list<device_record *>::iterator iter;
-		struct udev_device *device;
-		for(iter = m_device_records.begin(); iter != m_device_records.end(); iter++)
+		rusbCtrl_result_t result = RUSBCTRL_TIMEOUT;
+		int last_checked = 0;
+		lock_records();
+		while(true)
 		{
-			if(identifier == (*iter)->get_identifier())
+			/* Records are sorted by identifier, so only those added since the last pass need a look. */
+			std::list<device_record *>::iterator iter;
+			for(iter = m_device_records.begin(); iter != m_device_records.end(); iter++)
+			{
+				int candidate = (*iter)->get_identifier();
+				if(candidate <= last_checked)
+				{
+					continue;
+				}
+				last_checked = candidate;
+				if((*iter)->matches(*filter))
+				{
+					*identifier = candidate;
+					result = RUSBCTRL_SUCCESS;
+					break;
+				}
+			}
+			if((RUSBCTRL_SUCCESS == result) || (0 == timeout_ms))
 			{
-				device = (*iter)->get_device();
 				break;
 			}
-		}
-		if(iter != m_device_records.end())
-		{
-			DEBUG("Found record with identifer 0x%x. Querying...\n", identifier);
-			const char * value = udev_device_get_sysattr_value(device, key);
-			if(NULL == value)
+			int ret = (0 > timeout_ms ? pthread_cond_wait(&m_device_added, &m_mutex) :
+				pthread_cond_timedwait(&m_device_added, &m_mutex, &deadline));
+			if(ETIMEDOUT == ret)
 			{
-				ERROR("Could not find property %s.\n", key);
-				return NULL;
+				timeout_ms = 0; //One last look, then give up.
 			}
-			else
+		}
+		unlock_records();
+		return result;
+	}
+
+	device_record * acquire_record(int identifier, bool next)
+	{
+		device_record *record = NULL;
+		lock_records();
+		std::list<device_record *>::iterator iter;
+		for(iter = m_device_records.begin(); iter != m_device_records.end(); iter++)
+		{
+			/* Identifiers only grow and records are appended, so the list is sorted by identifier. */
+			if((next ? (identifier < (*iter)->get_identifier()) : (identifier == (*iter)->get_identifier())))
 			{
-				char * user_buffer = (char*)malloc(strlen(value)); //Will be freed by user
-				strncpy(user_buffer, value, strlen(value));
-				return user_buffer;
+				record = *iter;
+				record->acquire();
+				break;
 			}
 		}
-		ERROR("Found no record for device with id 0x%x\n", identifier);
-		return NULL;
+		unlock_records();
+		return record;
 	}
 
-	int register_callback(rusbCtrl_devCallback_t callback, void* callback_data, int ** device_list, int * device_list_size)
+	void get_stats(rusbCtrl_stats_t *stats)
 	{
-		//Note: device_list_size stands for the number of entries in the list, not the actual bytes
-		REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));	
-		m_callback = callback;
-		m_callback_data = callback_data;
-		if((NULL != device_list) && (NULL != device_list_size))
+		m_policy.get_stats(stats);
+		stats->recordLockAcquisitions = m_lock_acquisitions.load(std::memory_order_relaxed);
+		stats->recordLockContentions = m_lock_contentions.load(std::memory_order_relaxed);
+		lock_records();
+		stats->earlyEvents = m_stats.earlyEvents;
+		stats->earlyLastUsecs = m_stats.earlyLastUsecs;
+		stats->earlyMaxUsecs = m_stats.earlyMaxUsecs;
+		stats->earlyTotalUsecs = m_stats.earlyTotalUsecs;
+		stats->readyEvents = m_stats.readyEvents;
+		stats->readyLastUsecs = m_stats.readyLastUsecs;
+		stats->readyMaxUsecs = m_stats.readyMaxUsecs;
+		stats->readyTotalUsecs = m_stats.readyTotalUsecs;
+		stats->enumeratedDevices = m_stats.enumeratedDevices;
+		stats->enumerationUsecs = m_stats.enumerationUsecs;
+		stats->enumerationPrefetchUsecs = m_stats.enumerationPrefetchUsecs;
+		unlock_records();
+	}
+
+#ifdef USBCTRL_SYNTHETIC_EVENTS
+	/* Lets the stress test drive the add/remove path without udev. Synthetic records have no udev_device,
+	 * so devnode must stay valid for as long as the record exists. */
+	void inject_event(bool inserted, const char *devnode)
+	{
+		if(inserted)
 		{
-			get_connected_devices_list(device_list, device_list_size);	
+			struct timespec arrival;
+			clock_gettime(CLOCK_MONOTONIC, &arrival);
+			process_add_event(NULL, devnode, arrival);
 		}
 		else
 		{
-			ERROR("Empty pointers provided. Won't supply connected devices.\n");
+			process_remove_event(devnode);
 		}
-		REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));	
-		INFO("Success!\n");
-		return RUSBCTRL_SUCCESS;
 	}
+#endif
 	
 	void process_control_event()
 	{
@@ -287,6 +1207,7 @@ class device_manager
 			INFO("Detected EOF. Calling for shutdown.\n");
 			m_enable_monitoring = false;
 		}
+		/* CONTROL_MESSAGE_RESCAN needs nothing further: the fd set is rebuilt on every pass. */
 	}
 
 	void monitor_for_changes()
@@ -299,14 +1220,21 @@ class device_manager
 			ERROR("Critical error! Could not get udev monitor fd.\n");
 			return;
 		}
-		int max_fd = (monitor_fd > control_fd ? monitor_fd : control_fd);
 
 		while(true == m_enable_monitoring)
 		{
+			struct udev_monitor *kernel_monitor = get_kernel_monitor();
+			int kernel_fd = (NULL != kernel_monitor ? udev_monitor_get_fd(kernel_monitor) : -1);
+			int max_fd = (monitor_fd > control_fd ? monitor_fd : control_fd);
+			max_fd = (kernel_fd > max_fd ? kernel_fd : max_fd);
 			fd_set monitor_fd_set;
 			FD_ZERO(&monitor_fd_set);
 			FD_SET(monitor_fd, &monitor_fd_set);
 			FD_SET(control_fd, &monitor_fd_set);
+			if(0 <= kernel_fd)
+			{
+				FD_SET(kernel_fd, &monitor_fd_set);
+			}
 
 			int ret = select((max_fd + 1), &monitor_fd_set, NULL, NULL, NULL);
 			DEBUG("Unblocking now. ret is 0x%x\n", ret);
@@ -323,6 +1251,11 @@ class device_manager
 				{
 					process_control_event();			
 				}
+				/* Before the udev monitor, so that an arrival is reported before the device is ready. */
+				if((0 <= kernel_fd) && (0 != FD_ISSET(kernel_fd, &monitor_fd_set)))
+				{
+					process_kernel_monitor_event(kernel_monitor);
+				}
 				if(0 != FD_ISSET(monitor_fd, &monitor_fd_set))
 				{
 					process_udev_monitor_event();
@@ -335,12 +1268,41 @@ class device_manager
 			}
 
 		}
-		close(monitor_fd);
 		INFO("Monitor thread shutting down.\n");
 	}
 
 	private:
 
+	/* Wraps m_mutex to count how often callers had to wait for it. */
+	void lock_records()
+	{
+		int ret = pthread_mutex_trylock(&m_mutex);
+		if(EBUSY == ret)
+		{
+			m_lock_contentions.fetch_add(1, std::memory_order_relaxed);
+			ret = pthread_mutex_lock(&m_mutex);
+		}
+		REPORT_IF_UNEQUAL(0, ret);
+		m_lock_acquisitions.fetch_add(1, std::memory_order_relaxed);
+	}
+	void unlock_records()
+	{
+		REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+	}
+
+	device_record * find_record(int identifier) //needs lock
+	{
+		std::list<device_record *>::iterator iter;
+		for(iter = m_device_records.begin(); iter != m_device_records.end(); iter++)
+		{
+			if(identifier == (*iter)->get_identifier())
+			{
+				return *iter;
+			}
+		}
+		return NULL;
+	}
+
 	void reset_device_records() //needs lock
 	{
 		if(0 != m_device_records.size())
@@ -348,7 +1310,7 @@ class device_manager
 			std::list<device_record *>::iterator iter;
 			for(iter = m_device_records.begin(); iter != m_device_records.end(); iter++)
 			{
-				delete(*iter);
+				device_record::release(*iter);
 			}
 			m_device_records.clear();
 		}
@@ -377,12 +1339,14 @@ class device_manager
 	rusbCtrl_result_t enumerate_connected_devices()
 	{
 		rusbCtrl_result_t result = RUSBCTRL_SUCCESS;
-		REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));	
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		lock_records();
 		reset_device_records();	
 		struct udev_enumerate *enumerator = udev_enumerate_new(m_udev_context);
 		if(NULL == enumerator)
 		{
-			REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+			unlock_records();
 			ERROR("Could not create udev enumerator!\n");
 			return RUSBCTRL_FAILURE;
 		}
@@ -402,41 +1366,70 @@ class device_manager
 				break;
 			}
 
+			/* Read the attributes of all devices in one batch rather than a file at a time. */
+			std::vector<struct udev_device *> devices;
+			std::vector<size_t> first_attribute;
+			std::vector<prefetch_request> attributes;
 			struct udev_list_entry *device_list_head = udev_enumerate_get_list_entry(enumerator);
 			struct udev_list_entry *device_list_iterator = NULL;
 			udev_list_entry_foreach(device_list_iterator, device_list_head)
 			{
 				const char * sys_path = udev_list_entry_get_name(device_list_iterator);
 				struct udev_device *device = udev_device_new_from_syspath(m_udev_context, sys_path);
-				INFO("Detected device [syspath: %s, udev_device prt: 0x%x]\n", sys_path, (unsigned int)device);
+				INFO("Detected device [syspath: %s, udev_device prt: %p]\n", sys_path, device);
 				if(NULL != device)
 				{
-					int identifier; 
-					add_device_to_records(device, identifier);
+					devices.push_back(device);
+					first_attribute.push_back(attributes.size());
+					device_record::add_prefetch_requests(sys_path, attributes);
+				}
+			}
+			struct timespec prefetch_start;
+			clock_gettime(CLOCK_MONOTONIC, &prefetch_start);
+			const char *method = usbctrl_prefetch(attributes);
+			unsigned long prefetch_usecs = usecs_since(prefetch_start);
+			unsigned int added = 0;
+			for(size_t i = 0; i < devices.size(); i++)
+			{
+				int identifier; 
+				struct timespec arrival;
+				clock_gettime(CLOCK_MONOTONIC, &arrival);
+				device_record *record = new device_record(devices[i], udev_device_get_devnode(devices[i]), &attributes[first_attribute[i]]);
+				/* Devices that were connected before rusbCtrl_init() are subject to the policy as well. */
+				if(!m_policy.evaluate(*record, arrival))
+				{
+					device_record::release(record);
+					continue;
 				}
+				add_device_to_records(record, identifier);
+				added++;
 			}
+			m_stats.enumeratedDevices = added;
+			m_stats.enumerationUsecs = usecs_since(start);
+			m_stats.enumerationPrefetchUsecs = prefetch_usecs;
+			INFO("Enumerated %u devices in %luus, of which %luus reading %u sysfs files through %s.\n",
+				(unsigned int)devices.size(), m_stats.enumerationUsecs, prefetch_usecs, (unsigned int)attributes.size(), method);
 		}while(0);
-		REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+		unlock_records();
 		udev_enumerate_unref(enumerator);
 		return result;
 	}
 
-	bool add_device_to_records(struct udev_device *device, int &identifier) //needs lock
+	bool add_device_to_records(device_record *record, int &identifier) //needs lock
 	{
-		/* Create record and push it into the list. */
+		/* Publish the record by pushing it into the list. */
 		identifier = get_new_identifier();
-		INFO("Adding device 0x%x to records. Identifier is 0x%x\n", (unsigned int)device, identifier);
-		device_record *temp(new device_record(identifier, device, udev_device_get_devnode(device)));
-		m_device_records.push_back(temp);
-		print_device_properties(device);
+		INFO("Adding device %p to records. Identifier is 0x%x\n", record->get_device(), identifier);
+		record->set_identifier(identifier);
+		m_device_records.push_back(record);
+		print_device_properties(record);
 		return true;
 	}
 
-	bool remove_device_from_records(struct udev_device *device, int &identifier) //needs lock
+	bool remove_device_from_records(const char *devnode, int &identifier) //needs lock
 	{
 		identifier = -1;
-		DEBUG("Removing device 0%x from records.\n", (unsigned int)device);
-		const char * devnode = udev_device_get_devnode(device);
+		DEBUG("Removing device %s from records.\n", devnode);
 		if(NULL ==  devnode)
 		{
 			ERROR("Invalid devnode for incoming data.\n");
@@ -455,16 +1448,16 @@ class device_manager
 		if(iter != m_device_records.end())
 		{
 			INFO("Found record with identifer 0x%x. Removing it.\n", identifier);
-			delete(*iter);
+			device_record::release(*iter);
 			m_device_records.erase(iter);
 			return true;
 		}
 		ERROR("Found no record for device\n");
 		return false;
 	}
-	void print_device_properties(struct udev_device * device) //needs lock
+	void print_device_properties(device_record * record) //needs lock
 	{
-		INFO("USB device Node Path: %s\n", udev_device_get_devnode(device));
+		INFO("USB device Node Path: %s\n", record->get_devnode());
 #if 0
 		udev_list_entry *device_attr_list = udev_device_get_sysattr_list_entry(device);
 		udev_list_entry *current_attr = NULL;
@@ -479,6 +1472,8 @@ class device_manager
 	
 	void process_udev_monitor_event()
 	{
+		struct timespec arrival;
+		clock_gettime(CLOCK_MONOTONIC, &arrival);
 		struct udev_device *device = udev_monitor_receive_device(m_monitor);
 		if(NULL == device)
 		{
@@ -490,43 +1485,306 @@ class device_manager
 
 		if(0 == strncmp(action, UDEV_ADD_EVENT, strlen(UDEV_ADD_EVENT)))
 		{
-			//Process 'add' event.
-			int identifier;
-			bool result;
+			/* Copied, because term() on another thread may drop the record, and "device" with it, at any time. */
+			rusbCtrl_event_t event = {RUSBCTRL_EVENT_READY, 0, NULL, 0, 0, 0};
+			std::string syspath = udev_device_get_syspath(device);
+			read_product_ids(device, event);
+			/*Note: the object "device" is not unreffed here. Instead, the ownership has now been passed to
+			 * m_device_records list. "device" will be automatically unreffed when its device_record is destroyed.*/
+			event.devId = process_add_event(device, udev_device_get_devnode(device), arrival);
+			if(0 != event.devId)
 			{
-				REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));	
-				result = add_device_to_records(device, identifier);
-				/*Note: the object "device" is not unreffed here. Instead, the ownership has now been passed to
-				 * m_device_records list. "device" will be automatically unreffed when its device_record is destroyed.*/
-				REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+				event.syspath = syspath.c_str();
+				dispatch_ready_event(event);
+			}
+		}
+		else if(0 == strncmp(action, UDEV_REMOVE_EVENT, strlen(UDEV_REMOVE_EVENT)))
+		{
+			process_remove_event(udev_device_get_devnode(device));
+			udev_device_unref(device);
+		}
+		else
+		{
+			udev_device_unref(device);
+		}
+	}
+
+	/* Returns the identifier of the new record, or 0. */
+	int process_add_event(struct udev_device *device, const char *devnode, const struct timespec &arrival)
+	{
+		int identifier;
+		bool result;
+		rusbCtrl_devCallback_t callback;
+		void *callback_data;
+		/* Read sysfs and build the record before taking the lock, so that readers don't wait for it. */
+		std::vector<prefetch_request> attributes;
+		if(NULL != device)
+		{
+			device_record::add_prefetch_requests(udev_device_get_syspath(device), attributes);
+			usbctrl_prefetch(attributes);
+		}
+		device_record *record = new device_record(device, devnode, (attributes.empty() ? NULL : &attributes[0]));
+		/* Decide before the record lock and the user callback so that the write to sysfs is not delayed by either. */
+		if((NULL != device) && (!m_policy.evaluate(*record, arrival)))
+		{
+			/* De-authorized devices get no record, so the application never sees them. */
+			forget_arrival(udev_device_get_syspath(device));
+			device_record::release(record);
+			return 0;
+		}
+		/* The callback is sampled under the lock so that it is never seen half-updated by register_callback(). */
+		lock_records();
+		result = add_device_to_records(record, identifier);
+		callback = m_callback;
+		callback_data = m_callback_data;
+		if(result)
+		{
+			REPORT_IF_UNEQUAL(0, pthread_cond_broadcast(&m_device_added));
+		}
+		unlock_records();
+		if((result) && (callback))
+		{
+			callback(identifier, 1, callback_data);
+		}
+		if(result)
+		{
+			dispatch_to_listeners(identifier, 1);
+		}
+		return (result ? identifier : 0);
+	}
+
+	void process_remove_event(const char *devnode)
+	{
+		int identifier;
+		bool result;
+		rusbCtrl_devCallback_t callback;
+		void *callback_data;
+		lock_records();
+		result = remove_device_from_records(devnode, identifier);
+		callback = m_callback;
+		callback_data = m_callback_data;
+		unlock_records();
+		if((result) && (callback))
+		{
+			callback(identifier, 0, callback_data);
+		}
+		if(result)
+		{
+			dispatch_to_listeners(identifier, 0);
+		}
+	}
+
+	void dispatch_to_listeners(int identifier, int inserted)
+	{
+		REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_dispatch_mutex));
+		m_dispatch_depth++;
+		/* Listeners added by a callback are not called for the event that is being dispatched. */
+		size_t count = m_listeners.size();
+		std::list<listener>::iterator iter = m_listeners.begin();
+		for(size_t i = 0; i < count; i++, iter++)
+		{
+			if(NULL != iter->callback)
+			{
+				iter->callback(identifier, inserted, iter->callback_data);
+			}
+		}
+		m_dispatch_depth--;
+		std::vector<std::pair<rusbCtrl_deferredCall_t, void *> > deferred_calls;
+		if(0 == m_dispatch_depth)
+		{
+			for(iter = m_listeners.begin(); iter != m_listeners.end();)
+			{
+				iter = ((NULL == iter->callback) ? m_listeners.erase(iter) : ++iter);
 			}
-			if((result) && (m_callback))
+			deferred_calls.swap(m_deferred_calls);
+		}
+		REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_dispatch_mutex));
+		for(size_t i = 0; i < deferred_calls.size(); i++)
+		{
+			deferred_calls[i].first(deferred_calls[i].second);
+		}
+	}
+
+	rusbCtrl_result_t create_kernel_monitor() //needs lock
+	{
+		struct udev_monitor *monitor = udev_monitor_new_from_netlink(m_udev_context, "kernel");
+		if(NULL == monitor)
+		{
+			ERROR("Could not create kernel monitor!\n");
+			return RUSBCTRL_FAILURE;
+		}
+		if((0 != udev_monitor_filter_add_match_subsystem_devtype(monitor, "usb", "usb_device")) ||
+				(0 != udev_monitor_enable_receiving(monitor)))
+		{
+			ERROR("Could not set up kernel monitor!\n");
+			udev_monitor_unref(monitor);
+			return RUSBCTRL_FAILURE;
+		}
+		m_kernel_monitor.store(monitor);
+		/* Have the monitor thread add the new fd to its select() set. */
+		request_rescan();
+		return RUSBCTRL_SUCCESS;
+	}
+
+	void request_rescan()
+	{
+		int message = CONTROL_MESSAGE_RESCAN;
+		if((0 == m_control_pipe[PIPE_WRITE_FD]) ||
+				(CONTROL_MESSAGE_SIZE != write(m_control_pipe[PIPE_WRITE_FD], (void *)&message, CONTROL_MESSAGE_SIZE)))
+		{
+			ERROR("Could not wake up monitor thread.\n");
+		}
+	}
+
+	/* Returns the kernel monitor for the monitor thread to listen to. Once early notification has been disabled it is
+	 * released, so that uevents are no longer received at all. Only the monitor thread reads from it, so this is safe. */
+	struct udev_monitor * get_kernel_monitor()
+	{
+		struct udev_monitor *monitor = m_kernel_monitor.load();
+		if(NULL != monitor)
+		{
+			lock_records();
+			if(NULL == m_event_callback)
 			{
-				m_callback(identifier, 1, m_callback_data);
+				m_kernel_monitor.store(NULL);
+				udev_monitor_unref(monitor);
+				monitor = NULL;
+				INFO("Kernel monitor closed.\n");
 			}
+			unlock_records();
+		}
+		return monitor;
+	}
 
+	/* PRODUCT is "vendor/product/bcdDevice" in hex, straight from the uevent, so this does not touch sysfs. */
+	static void read_product_ids(struct udev_device *device, rusbCtrl_event_t &event)
+	{
+		const char *product = udev_device_get_property_value(device, "PRODUCT");
+		if(NULL != product)
+		{
+			char *end = NULL;
+			event.vendorId = (uint16_t)strtoul(product, &end, 16);
+			if('/' == *end)
+			{
+				event.productId = (uint16_t)strtoul(end + 1, NULL, 16);
+			}
 		}
-		else if(0 == strncmp(action, UDEV_REMOVE_EVENT, strlen(UDEV_REMOVE_EVENT)))
+	}
+
+	static void update_latency(unsigned long latency, unsigned long &count, unsigned long &last, unsigned long &max, unsigned long &total)
+	{
+		count++;
+		last = latency;
+		total += latency;
+		if(latency > max)
+		{
+			max = latency;
+		}
+	}
+
+	/* The kernel announces a device before udevd has run its rules. 'add' starts tracking the arrival and 'remove' stops
+	 * it, for devices that udev never reported. Removal itself is reported through the regular path. */
+	void process_kernel_monitor_event(struct udev_monitor *monitor)
+	{
+		struct timespec arrival;
+		clock_gettime(CLOCK_MONOTONIC, &arrival);
+		struct udev_device *device = udev_monitor_receive_device(monitor);
+		if(NULL == device)
+		{
+			ERROR("udev_monitor_receive_device failed for kernel monitor!\n");
+			return;
+		}
+		const char *action = udev_device_get_action(device);
+		const char *syspath = udev_device_get_syspath(device);
+		if((NULL != action) && (NULL != syspath) && (0 == strcmp(action, UDEV_REMOVE_EVENT)))
+		{
+			forget_arrival(syspath);
+		}
+		else if((NULL != action) && (NULL != syspath) && (0 == strcmp(action, UDEV_ADD_EVENT)))
 		{
-			//Process 'remove' event.
-			int identifier;
-			bool result;
+			rusbCtrl_event_t event = {RUSBCTRL_EVENT_ARRIVING, 0, syspath, 0, 0, 0};
+			read_product_ids(device, event);
+			rusbCtrl_eventCallback_t callback;
+			void *callback_data;
+			lock_records();
+			callback = m_event_callback;
+			callback_data = m_event_callback_data;
+			if(NULL != callback)
 			{
-				REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));
-				result = remove_device_from_records(device, identifier);
-				REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+				if(MAX_PENDING_ARRIVALS <= m_pending_arrivals.size())
+				{
+					forget_oldest_arrival();
+				}
+				m_pending_arrivals[syspath] = arrival;
 			}
-			udev_device_unref(device);
-			if((result) && (m_callback))
+			unlock_records();
+			if(NULL != callback)
 			{
-				m_callback(identifier, 0, m_callback_data);
+				INFO("Device %04x:%04x arriving at %s.\n", event.vendorId, event.productId, syspath);
+				callback(&event, callback_data);
+				unsigned long latency = usecs_since(arrival);
+				lock_records();
+				update_latency(latency, m_stats.earlyEvents, m_stats.earlyLastUsecs, m_stats.earlyMaxUsecs, m_stats.earlyTotalUsecs);
+				unlock_records();
 			}
 		}
-		else
+		udev_device_unref(device);
+	}
+
+	/* udev never reported the oldest arrival, and the kernel's 'remove' was missed. Drop it so that they cannot pile up. */
+	void forget_oldest_arrival() //needs lock
+	{
+		std::unordered_map<std::string, struct timespec>::iterator oldest = m_pending_arrivals.begin();
+		std::unordered_map<std::string, struct timespec>::iterator iter;
+		for(iter = m_pending_arrivals.begin(); iter != m_pending_arrivals.end(); iter++)
 		{
-			udev_device_unref(device);
+			if((iter->second.tv_sec < oldest->second.tv_sec) ||
+					((iter->second.tv_sec == oldest->second.tv_sec) && (iter->second.tv_nsec < oldest->second.tv_nsec)))
+			{
+				oldest = iter;
+			}
+		}
+		if(oldest != m_pending_arrivals.end())
+		{
+			WARN("Dropping stale arrival %s.\n", oldest->first.c_str());
+			m_pending_arrivals.erase(oldest);
+		}
+	}
+
+	void forget_arrival(const char *syspath)
+	{
+		if(NULL != syspath)
+		{
+			lock_records();
+			m_pending_arrivals.erase(syspath);
+			unlock_records();
+		}
+	}
+
+	void dispatch_ready_event(rusbCtrl_event_t &event)
+	{
+		rusbCtrl_eventCallback_t callback;
+		void *callback_data;
+		lock_records();
+		callback = m_event_callback;
+		callback_data = m_event_callback_data;
+		std::unordered_map<std::string, struct timespec>::iterator pending = m_pending_arrivals.find(event.syspath);
+		if(pending != m_pending_arrivals.end())
+		{
+			unsigned long latency = usecs_since(pending->second);
+			update_latency(latency, m_stats.readyEvents, m_stats.readyLastUsecs,
+				m_stats.readyMaxUsecs, m_stats.readyTotalUsecs);
+			event.elapsedUsecs = latency;
+			m_pending_arrivals.erase(pending);
+		}
+		unlock_records();
+		if(NULL != callback)
+		{
+			INFO("Device 0x%x ready %luus after arrival.\n", event.devId, event.elapsedUsecs);
+			callback(&event, callback_data);
 		}
 	}
+
 	int get_new_identifier() //needs lock
 	{
 		//TODO: handle roll-over
@@ -557,3 +1815,136 @@ char *rusbCtrl_getProperty(int devId, const char *propertyName)
 	return manager.get_property(devId, propertyName);
 }
 
+int rusbCtrl_addPolicyRule(const rusbCtrl_deviceMatch_t *match, rusbCtrl_policyAction_t action)
+{
+	return manager.get_policy().add_rule(match, action);
+}
+int rusbCtrl_setDefaultPolicy(rusbCtrl_policyAction_t action)
+{
+	return manager.get_policy().set_default_action(action);
+}
+int rusbCtrl_clearPolicyRules(void)
+{
+	return manager.get_policy().clear_rules();
+}
+int rusbCtrl_getStats(rusbCtrl_stats_t *stats)
+{
+	if(NULL == stats)
+	{
+		return RUSBCTRL_FAILURE;
+	}
+	manager.get_stats(stats);
+	return RUSBCTRL_SUCCESS;
+}
+
+#define DEFINE_NUMERIC_GETTER(name, type, property, field) \
+int name(int devId, type *value) \
+{ \
+	device_manager::device_record::numeric_properties properties; \
+	if((NULL == value) || (RUSBCTRL_SUCCESS != manager.get_numeric_property(devId, property, properties))) \
+	{ \
+		return RUSBCTRL_FAILURE; \
+	} \
+	*value = properties.field; \
+	return RUSBCTRL_SUCCESS; \
+}
+DEFINE_NUMERIC_GETTER(rusbCtrl_getVendorId, uint16_t, RUSBCTRL_PROPNAME_VENDOR, vendor_id)
+DEFINE_NUMERIC_GETTER(rusbCtrl_getProductId, uint16_t, RUSBCTRL_PROPNAME_MODEL, product_id)
+DEFINE_NUMERIC_GETTER(rusbCtrl_getDeviceClass, uint8_t, RUSBCTRL_PROPNAME_DEVCLASS, device_class)
+DEFINE_NUMERIC_GETTER(rusbCtrl_getDeviceSubClass, uint8_t, RUSBCTRL_PROPNAME_DEVSUBCLASS, device_subclass)
+DEFINE_NUMERIC_GETTER(rusbCtrl_getSpeed, uint32_t, RUSBCTRL_PROPNAME_SPEED, speed_kbps)
+DEFINE_NUMERIC_GETTER(rusbCtrl_getBusNum, uint16_t, RUSBCTRL_PROPNAME_BUSNUM, busnum)
+DEFINE_NUMERIC_GETTER(rusbCtrl_getDevNum, uint16_t, RUSBCTRL_PROPNAME_DEVNUM, devnum)
+#undef DEFINE_NUMERIC_GETTER
+
+int rusbCtrl_waitForDevice(const rusbCtrl_deviceMatch_t *filter, int timeoutMs, int *devId)
+{
+	return manager.wait_for_device(filter, timeoutMs, devId);
+}
+int rusbCtrl_getDeviceDescriptor(int devId, rusbCtrl_deviceDescriptor_t *descriptor)
+{
+	return (NULL == descriptor ? RUSBCTRL_FAILURE : manager.get_device_descriptor(devId, descriptor));
+}
+int rusbCtrl_getConfigDescriptor(int devId, int configIndex, rusbCtrl_configDescriptor_t *descriptor)
+{
+	return (NULL == descriptor ? RUSBCTRL_FAILURE : manager.get_config_descriptor(devId, configIndex, descriptor));
+}
+int rusbCtrl_getInterfaceDescriptor(int devId, int configIndex, int interfaceIndex, rusbCtrl_interfaceDescriptor_t *descriptor)
+{
+	return (NULL == descriptor ? RUSBCTRL_FAILURE : manager.get_interface_descriptor(devId, configIndex, interfaceIndex, descriptor));
+}
+int rusbCtrl_getEndpointDescriptor(int devId, int configIndex, int interfaceIndex, int endpointIndex,
+		rusbCtrl_endpointDescriptor_t *descriptor)
+{
+	return (NULL == descriptor ? RUSBCTRL_FAILURE :
+		manager.get_endpoint_descriptor(devId, configIndex, interfaceIndex, endpointIndex, descriptor));
+}
+int rusbCtrl_matchDevice(int devId, const rusbCtrl_deviceMatch_t *filter)
+{
+	return manager.match_device(devId, filter);
+}
+int rusbCtrl_enableEarlyNotification(rusbCtrl_eventCallback_t cb, void *cbData)
+{
+	return manager.enable_early_notification(cb, cbData);
+}
+int rusbCtrl_addListener(rusbCtrl_devCallback_t cb, void *cbData, int *listenerId)
+{
+	return manager.add_listener(cb, cbData, listenerId);
+}
+int rusbCtrl_removeListener(int listenerId)
+{
+	return manager.remove_listener(listenerId);
+}
+int rusbCtrl_runAfterDispatch(rusbCtrl_deferredCall_t call, void *cbData)
+{
+	return manager.run_after_dispatch(call, cbData);
+}
+rusbCtrl_device_t rusbCtrl_acquireDevice(int devId)
+{
+	return (rusbCtrl_device_t)manager.acquire_record(devId, false);
+}
+rusbCtrl_device_t rusbCtrl_acquireNextDevice(int afterDevId)
+{
+	return (rusbCtrl_device_t)manager.acquire_record(afterDevId, true);
+}
+void rusbCtrl_releaseDevice(rusbCtrl_device_t device)
+{
+	if(NULL != device)
+	{
+		device_manager::device_record::release((device_manager::device_record *)device);
+	}
+}
+int rusbCtrl_deviceGetId(rusbCtrl_device_t device)
+{
+	return (NULL == device ? -1 : ((device_manager::device_record *)device)->get_identifier());
+}
+const char *rusbCtrl_deviceGetProperty(rusbCtrl_device_t device, rusbCtrl_propname_t property, size_t *length)
+{
+	device_manager::device_record *record = (device_manager::device_record *)device;
+	if((NULL == record) || (property < 0) || (property >= SUPPORTED_PROPERTY_COUNT) || (!record->has_property(property)))
+	{
+		return NULL;
+	}
+	const std::string &value = record->get_property(property);
+	if(NULL != length)
+	{
+		*length = value.size();
+	}
+	return value.c_str();
+}
+int rusbCtrl_deviceGetNumericProperty(rusbCtrl_device_t device, rusbCtrl_propname_t property, uint32_t *value)
+{
+	device_manager::device_record *record = (device_manager::device_record *)device;
+	if((NULL == record) || (NULL == value) || (!record->get_numeric_property(property, *value)))
+	{
+		return RUSBCTRL_FAILURE;
+	}
+	return RUSBCTRL_SUCCESS;
+}
+
+#ifdef USBCTRL_SYNTHETIC_EVENTS
+void usbctrl_inject_event(int inserted, const char *devnode)
+{
+	manager.inject_event((0 != inserted), devnode);
+}
+#endif
@@ -0,0 +1,132 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "usbctrl_descriptors.h"
+#include "usbctrl_log.h"
+#include <string.h>
+#include <algorithm>
+
+usb_descriptors::usb_descriptors() : m_valid(false)
+{
+	memset(&m_device, 0, sizeof(m_device));
+}
+
+bool usb_descriptors::parse(const uint8_t *data, size_t size)
+{
+	m_configs.clear();
+	m_valid = false;
+	if((size < DEVICE_DESCRIPTOR_SIZE) || (DESCRIPTOR_TYPE_DEVICE != data[1]))
+	{
+		ERROR("Malformed device descriptor.\n");
+		return false;
+	}
+	m_device.bcdUSB = le16(&data[2]);
+	m_device.deviceClass = data[4];
+	m_device.deviceSubClass = data[5];
+	m_device.deviceProtocol = data[6];
+	m_device.maxPacketSize0 = data[7];
+	m_device.vendorId = le16(&data[8]);
+	m_device.productId = le16(&data[10]);
+	m_device.bcdDevice = le16(&data[12]);
+	m_device.numConfigurations = data[17];
+
+	config_info *config = NULL;
+	interface_info *interface = NULL;
+	for(size_t offset = data[0]; (offset + 2) <= size;)
+	{
+		const uint8_t *descriptor = &data[offset];
+		size_t length = descriptor[0];
+		if((length < 2) || ((offset + length) > size))
+		{
+			/* Keep what was parsed so far; the rest cannot be trusted. */
+			ERROR("Malformed descriptor at offset %u.\n", (unsigned int)offset);
+			break;
+		}
+		switch(descriptor[1])
+		{
+			case DESCRIPTOR_TYPE_CONFIG:
+				if(length >= CONFIG_DESCRIPTOR_SIZE)
+				{
+					m_configs.push_back(config_info());
+					config = &m_configs.back();
+					interface = NULL;
+					config->descriptor.configurationValue = descriptor[5];
+					config->descriptor.attributes = descriptor[7];
+					config->descriptor.selfPowered = ((descriptor[7] & 0x40) ? 1 : 0);
+					config->descriptor.remoteWakeup = ((descriptor[7] & 0x20) ? 1 : 0);
+					config->descriptor.maxPowerMilliAmps = descriptor[8] * 2;
+					config->descriptor.numInterfaces = 0;
+				}
+				break;
+			case DESCRIPTOR_TYPE_INTERFACE:
+				if((NULL != config) && (length >= INTERFACE_DESCRIPTOR_SIZE))
+				{
+					config->interfaces.push_back(interface_info());
+					interface = &config->interfaces.back();
+					interface->descriptor.interfaceNumber = descriptor[2];
+					interface->descriptor.alternateSetting = descriptor[3];
+					interface->descriptor.numEndpoints = descriptor[4];
+					interface->descriptor.interfaceClass = descriptor[5];
+					interface->descriptor.interfaceSubClass = descriptor[6];
+					interface->descriptor.interfaceProtocol = descriptor[7];
+					config->descriptor.numInterfaces = (uint8_t)config->interfaces.size();
+				}
+				break;
+			case DESCRIPTOR_TYPE_ENDPOINT:
+				if((NULL != interface) && (length >= ENDPOINT_DESCRIPTOR_SIZE))
+				{
+					rusbCtrl_endpointDescriptor_t endpoint;
+					uint16_t max_packet_size = le16(&descriptor[4]);
+					endpoint.address = descriptor[2];
+					endpoint.directionIn = ((descriptor[2] & 0x80) ? 1 : 0);
+					endpoint.type = (rusbCtrl_endpointType_t)(descriptor[3] & 0x03);
+					endpoint.maxPacketSize = max_packet_size & 0x7ff;
+					/* Bits 12..11 count additional transactions; 3 is reserved, so clamp to the 1 to 3 promised. */
+					endpoint.transactionsPerMicroframe = 1 + std::min((max_packet_size >> 11) & 0x03, 2);
+					endpoint.interval = descriptor[6];
+					interface->endpoints.push_back(endpoint);
+				}
+				break;
+			default:
+				/* Class-specific, interface association, SuperSpeed companion and so on. */
+				break;
+		}
+		offset += length;
+	}
+	m_valid = true;
+	return true;
+}
+
+void usb_descriptors::set_super_speed()
+{
+	for(size_t i = 0; i < m_configs.size(); i++)
+	{
+		m_configs[i].descriptor.maxPowerMilliAmps *= 4;
+	}
+}
+
+void usb_descriptors::get_interface_classes(std::vector<uint8_t> &classes) const
+{
+	for(size_t c = 0; c < m_configs.size(); c++)
+	{
+		for(size_t i = 0; i < m_configs[c].interfaces.size(); i++)
+		{
+			classes.push_back(m_configs[c].interfaces[i].descriptor.interfaceClass);
+		}
+	}
+}
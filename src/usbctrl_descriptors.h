@@ -0,0 +1,92 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _USBCTRL_DESCRIPTORS_H_
+#define _USBCTRL_DESCRIPTORS_H_
+
+#include "usbctrl.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* Parsed form of the binary "descriptors" sysfs attribute: the device descriptor followed by each configuration
+ * descriptor together with its interface, endpoint and class-specific descriptors. */
+class usb_descriptors
+{
+	public:
+	struct interface_info
+	{
+		rusbCtrl_interfaceDescriptor_t descriptor;
+		std::vector<rusbCtrl_endpointDescriptor_t> endpoints;
+	};
+	struct config_info
+	{
+		rusbCtrl_configDescriptor_t descriptor;
+		std::vector<interface_info> interfaces;
+	};
+
+	private:
+	static const uint8_t DESCRIPTOR_TYPE_DEVICE = 0x01;
+	static const uint8_t DESCRIPTOR_TYPE_CONFIG = 0x02;
+	static const uint8_t DESCRIPTOR_TYPE_INTERFACE = 0x04;
+	static const uint8_t DESCRIPTOR_TYPE_ENDPOINT = 0x05;
+	static const size_t DEVICE_DESCRIPTOR_SIZE = 18;
+	static const size_t CONFIG_DESCRIPTOR_SIZE = 9;
+	static const size_t INTERFACE_DESCRIPTOR_SIZE = 9;
+	static const size_t ENDPOINT_DESCRIPTOR_SIZE = 7;
+
+	bool m_valid;
+	rusbCtrl_deviceDescriptor_t m_device;
+	std::vector<config_info> m_configs;
+
+	public:
+	usb_descriptors();
+
+	/* Returns false, and leaves the object invalid, if there is no complete device descriptor. Anything after the
+	 * first malformed descriptor is ignored, as are interfaces outside a configuration and endpoints outside an
+	 * interface. */
+	bool parse(const uint8_t *data, size_t size);
+
+	/* bMaxPower is in 8 mA units on SuperSpeed and in 2 mA units otherwise. */
+	void set_super_speed();
+
+	inline bool is_valid() const {return m_valid;}
+	inline const rusbCtrl_deviceDescriptor_t & get_device() const {return m_device;}
+	const config_info * get_config(int config) const
+	{
+		return (((0 <= config) && ((size_t)config < m_configs.size())) ? &m_configs[config] : NULL);
+	}
+	const interface_info * get_interface(int config, int interface) const
+	{
+		const config_info *parent = get_config(config);
+		return (((NULL != parent) && (0 <= interface) && ((size_t)interface < parent->interfaces.size())) ?
+			&parent->interfaces[interface] : NULL);
+	}
+	const rusbCtrl_endpointDescriptor_t * get_endpoint(int config, int interface, int endpoint) const
+	{
+		const interface_info *parent = get_interface(config, interface);
+		return (((NULL != parent) && (0 <= endpoint) && ((size_t)endpoint < parent->endpoints.size())) ?
+			&parent->endpoints[endpoint] : NULL);
+	}
+	void get_interface_classes(std::vector<uint8_t> &classes) const;
+
+	private:
+	static inline uint16_t le16(const uint8_t *data) {return (uint16_t)(data[0] | (data[1] << 8));}
+};
+
+#endif /* _USBCTRL_DESCRIPTORS_H_ */
@@ -0,0 +1,383 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "usbctrl_log.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <syslog.h>
+#include <semaphore.h>
+#include "pthread.h"
+
+//#define ENABLE_DEBUG 1
+#ifdef ENABLE_DEBUG
+static const int DEFAULT_LOG_LEVEL = RUSBCTRL_LOG_DEBUG;
+#else
+static const int DEFAULT_LOG_LEVEL = RUSBCTRL_LOG_INFO;
+#endif
+static const unsigned int LOG_RING_ENTRIES = 128;
+static const int LOG_ENTRY_SIZE = 256;
+static const char * const level_names[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+
+/* Constant-initialized so that it is valid before any constructor runs. See usbctrl_log.h. */
+std::atomic<int> usbctrl_log_level(INT_MAX);
+
+class log_writer
+{
+	private:
+	struct log_entry
+	{
+		rusbCtrl_logLevel_t level;
+		char text[LOG_ENTRY_SIZE];
+	};
+
+	/* Single-producer/single-consumer ring. The producer is the thread that owns it, the consumer is the writer thread.
+	 * Rings are never freed: when a thread exits its ring is marked free and handed to the next new thread. */
+	struct log_ring
+	{
+		log_entry entries[LOG_RING_ENTRIES];
+		std::atomic<unsigned int> head;
+		std::atomic<unsigned int> tail;
+		std::atomic<unsigned long> dropped;
+		std::atomic<bool> in_use;
+		log_ring *next;
+	};
+
+	std::atomic<log_ring *> m_rings;
+	pthread_key_t m_ring_key;
+	sem_t m_wakeup;
+	std::atomic<bool> m_running;
+	pthread_t m_writer_thread;
+
+	pthread_mutex_t m_sink_mutex;
+	rusbCtrl_logSink_t m_sink;
+	FILE *m_file;
+	rusbCtrl_logCallback_t m_callback;
+	void *m_callback_data;
+	/* The user callback runs without m_sink_mutex, so that it may change the sink itself. set_sink() waits for it
+	 * on m_callback_done, unless it is called from within the callback. */
+	bool m_in_callback;
+	pthread_t m_callback_thread;
+	pthread_cond_t m_callback_done;
+
+	log_writer() : m_rings(NULL), m_running(true), m_writer_thread(0), m_sink(RUSBCTRL_LOG_SINK_STDOUT), m_file(NULL),
+		m_callback(NULL), m_callback_data(NULL), m_in_callback(false), m_callback_thread(0)
+	{
+		int level = DEFAULT_LOG_LEVEL;
+		const char *env = getenv("RUSBCTRL_LOG_LEVEL");
+		if((NULL != env) && (env[0] >= '0') && (env[0] <= '3'))
+		{
+			level = env[0] - '0';
+		}
+		usbctrl_log_level.store(level, std::memory_order_relaxed);
+
+		pthread_mutex_init(&m_sink_mutex, NULL);
+		pthread_cond_init(&m_callback_done, NULL);
+		pthread_key_create(&m_ring_key, log_writer::release_ring);
+		sem_init(&m_wakeup, 0, 0);
+		if(0 != pthread_create(&m_writer_thread, NULL, log_writer::writer_thread_wrapper, (void *)this))
+		{
+			/* Without a writer, log synchronously rather than losing everything. */
+			m_writer_thread = 0;
+		}
+	}
+
+	public:
+	~log_writer()
+	{
+		if(0 != m_writer_thread)
+		{
+			m_running.store(false);
+			sem_post(&m_wakeup);
+			pthread_join(m_writer_thread, NULL);
+		}
+		set_sink(RUSBCTRL_LOG_SINK_STDOUT, NULL, NULL, NULL);
+		sem_destroy(&m_wakeup);
+		pthread_cond_destroy(&m_callback_done);
+		pthread_mutex_destroy(&m_sink_mutex);
+	}
+
+	static log_writer & instance()
+	{
+		static log_writer writer;
+		return writer;
+	}
+
+	void log(rusbCtrl_logLevel_t level, const char *function, int line, const char *format, va_list args)
+	{
+		if(0 == m_writer_thread)
+		{
+			char text[LOG_ENTRY_SIZE];
+			format_entry(text, level, function, line, format, args);
+			pthread_mutex_lock(&m_sink_mutex);
+			write_to_sink(level, text);
+			pthread_mutex_unlock(&m_sink_mutex);
+			return;
+		}
+
+		log_ring *ring = get_thread_ring();
+		unsigned int head = ring->head.load(std::memory_order_relaxed);
+		if((head - ring->tail.load(std::memory_order_acquire)) >= LOG_RING_ENTRIES)
+		{
+			ring->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		log_entry &entry = ring->entries[head % LOG_RING_ENTRIES];
+		entry.level = level;
+		format_entry(entry.text, level, function, line, format, args);
+		ring->head.store(head + 1, std::memory_order_release);
+		sem_post(&m_wakeup);
+	}
+
+	rusbCtrl_result_t set_sink(rusbCtrl_logSink_t sink, const char *file_path, rusbCtrl_logCallback_t callback, void *callback_data)
+	{
+		FILE *file = NULL;
+		if(RUSBCTRL_LOG_SINK_FILE == sink)
+		{
+			if((NULL == file_path) || (NULL == (file = fopen(file_path, "a"))))
+			{
+				return RUSBCTRL_FAILURE;
+			}
+		}
+		else if((RUSBCTRL_LOG_SINK_CALLBACK == sink) && (NULL == callback))
+		{
+			return RUSBCTRL_FAILURE;
+		}
+
+		pthread_mutex_lock(&m_sink_mutex);
+		/* Once this returns, the old callback is neither running nor called again. */
+		while(m_in_callback && (0 == pthread_equal(m_callback_thread, pthread_self())))
+		{
+			pthread_cond_wait(&m_callback_done, &m_sink_mutex);
+		}
+		if(NULL != m_file)
+		{
+			fclose(m_file);
+		}
+		if(RUSBCTRL_LOG_SINK_SYSLOG == m_sink)
+		{
+			closelog();
+		}
+		if(RUSBCTRL_LOG_SINK_SYSLOG == sink)
+		{
+			openlog("usbctrl", LOG_PID, LOG_USER);
+		}
+		m_sink = sink;
+		m_file = file;
+		m_callback = callback;
+		m_callback_data = callback_data;
+		pthread_mutex_unlock(&m_sink_mutex);
+		return RUSBCTRL_SUCCESS;
+	}
+
+	private:
+	static void format_entry(char *text, rusbCtrl_logLevel_t level, const char *function, int line, const char *format, va_list args)
+	{
+		int length = snprintf(text, LOG_ENTRY_SIZE, "%s[%d] - %s: ", function, line, level_names[level]);
+		if((0 <= length) && (length < LOG_ENTRY_SIZE))
+		{
+			int remaining = vsnprintf(text + length, LOG_ENTRY_SIZE - length, format, args);
+			if(remaining >= (LOG_ENTRY_SIZE - length))
+			{
+				/* Truncated. Keep the line terminated. */
+				text[LOG_ENTRY_SIZE - 2] = '\n';
+			}
+		}
+	}
+
+	log_ring * get_thread_ring()
+	{
+		log_ring *ring = (log_ring *)pthread_getspecific(m_ring_key);
+		if(NULL != ring)
+		{
+			return ring;
+		}
+		for(ring = m_rings.load(std::memory_order_acquire); NULL != ring; ring = ring->next)
+		{
+			bool expected = false;
+			if(ring->in_use.compare_exchange_strong(expected, true))
+			{
+				break;
+			}
+		}
+		if(NULL == ring)
+		{
+			ring = new log_ring;
+			ring->head.store(0);
+			ring->tail.store(0);
+			ring->dropped.store(0);
+			ring->in_use.store(true);
+			ring->next = m_rings.load(std::memory_order_relaxed);
+			while(!m_rings.compare_exchange_weak(ring->next, ring, std::memory_order_release, std::memory_order_relaxed));
+		}
+		pthread_setspecific(m_ring_key, ring);
+		return ring;
+	}
+
+	static void release_ring(void *data)
+	{
+		((log_ring *)data)->in_use.store(false, std::memory_order_release);
+	}
+
+	static void * writer_thread_wrapper(void *data)
+	{
+		((log_writer *)data)->write_logs();
+		return NULL;
+	}
+
+	void write_logs()
+	{
+		while(true)
+		{
+			while((0 != sem_wait(&m_wakeup)) && (EINTR == errno));
+			/* Every message posts once; collapse the backlog into a single pass. */
+			while(0 == sem_trywait(&m_wakeup));
+			bool running = m_running.load();
+			drain_rings();
+			if(!running)
+			{
+				break;
+			}
+		}
+	}
+
+	void drain_rings()
+	{
+		pthread_mutex_lock(&m_sink_mutex);
+		for(log_ring *ring = m_rings.load(std::memory_order_acquire); NULL != ring; ring = ring->next)
+		{
+			unsigned int head = ring->head.load(std::memory_order_acquire);
+			unsigned int tail = ring->tail.load(std::memory_order_relaxed);
+			for(; tail != head; tail++)
+			{
+				const log_entry &entry = ring->entries[tail % LOG_RING_ENTRIES];
+				write_to_sink(entry.level, entry.text);
+				ring->tail.store(tail + 1, std::memory_order_release);
+			}
+			unsigned long dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+			if(0 != dropped)
+			{
+				char text[64];
+				snprintf(text, sizeof(text), "log_writer: %lu log lines dropped.\n", dropped);
+				write_to_sink(RUSBCTRL_LOG_WARN, text);
+			}
+		}
+		if(NULL != m_file)
+		{
+			fflush(m_file);
+		}
+		else if(RUSBCTRL_LOG_SINK_STDOUT == m_sink)
+		{
+			fflush(stdout);
+		}
+		pthread_mutex_unlock(&m_sink_mutex);
+	}
+
+	void run_callback(rusbCtrl_logLevel_t level, const char *text) //needs sink lock
+	{
+		if(m_in_callback && (0 != pthread_equal(m_callback_thread, pthread_self())))
+		{
+			/* The callback logged something through the synchronous path; don't recurse into it. */
+			return;
+		}
+		while(m_in_callback)
+		{
+			pthread_cond_wait(&m_callback_done, &m_sink_mutex);
+		}
+		if(RUSBCTRL_LOG_SINK_CALLBACK != m_sink)
+		{
+			write_to_sink(level, text);
+			return;
+		}
+		rusbCtrl_logCallback_t callback = m_callback;
+		void *callback_data = m_callback_data;
+		m_in_callback = true;
+		m_callback_thread = pthread_self();
+		pthread_mutex_unlock(&m_sink_mutex);
+		callback(level, text, callback_data);
+		pthread_mutex_lock(&m_sink_mutex);
+		m_in_callback = false;
+		pthread_cond_broadcast(&m_callback_done);
+	}
+
+	void write_to_sink(rusbCtrl_logLevel_t level, const char *text) //needs sink lock
+	{
+		static const int syslog_priorities[] = {LOG_ERR, LOG_WARNING, LOG_INFO, LOG_DEBUG};
+		switch(m_sink)
+		{
+			case RUSBCTRL_LOG_SINK_SYSLOG:
+				syslog(syslog_priorities[level], "%s", text);
+				break;
+			case RUSBCTRL_LOG_SINK_FILE:
+				fputs(text, m_file);
+				break;
+			case RUSBCTRL_LOG_SINK_CALLBACK:
+				run_callback(level, text);
+				break;
+			default:
+				fputs(text, stdout);
+				break;
+		}
+	}
+};
+
+void usbctrl_log(rusbCtrl_logLevel_t level, const char *function, int line, const char *format, ...)
+{
+	log_writer &writer = log_writer::instance();
+	/* The first call sets up the writer, which also settles the level. */
+	if(level > usbctrl_log_level.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+	va_list args;
+	va_start(args, format);
+	writer.log(level, function, line, format, args);
+	va_end(args);
+}
+
+int rusbCtrl_setLogLevel(rusbCtrl_logLevel_t level)
+{
+	if((level < RUSBCTRL_LOG_ERROR) || (level > RUSBCTRL_LOG_DEBUG))
+	{
+		return RUSBCTRL_FAILURE;
+	}
+	log_writer::instance();
+	usbctrl_log_level.store(level, std::memory_order_relaxed);
+	return RUSBCTRL_SUCCESS;
+}
+
+int rusbCtrl_setLogSink(rusbCtrl_logSink_t sink, const char *filePath)
+{
+	if(RUSBCTRL_LOG_SINK_CALLBACK == sink)
+	{
+		return RUSBCTRL_FAILURE;
+	}
+	return log_writer::instance().set_sink(sink, filePath, NULL, NULL);
+}
+
+int rusbCtrl_setLogCallback(rusbCtrl_logCallback_t cb, void *cbData)
+{
+	if(NULL == cb)
+	{
+		return log_writer::instance().set_sink(RUSBCTRL_LOG_SINK_STDOUT, NULL, NULL, NULL);
+	}
+	return log_writer::instance().set_sink(RUSBCTRL_LOG_SINK_CALLBACK, NULL, cb, cbData);
+}
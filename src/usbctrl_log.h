@@ -0,0 +1,41 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _USBCTRL_LOG_H_
+#define _USBCTRL_LOG_H_
+
+#include "usbctrl.h"
+#include <atomic>
+
+/* Internal logging interface. The level check is a single relaxed load, so disabled levels cost nothing beyond it;
+ * enabled messages are formatted into the calling thread's ring buffer and written out by the log writer thread.
+ * Until the writer is set up the level reads as "everything", which lets usbctrl_log() set it up and re-check. */
+extern std::atomic<int> usbctrl_log_level;
+
+void usbctrl_log(rusbCtrl_logLevel_t level, const char *function, int line, const char *format, ...)
+	__attribute__((format(printf, 4, 5)));
+
+#define LOG(level, text, ...) do {\
+    if((level) <= usbctrl_log_level.load(std::memory_order_relaxed)) usbctrl_log((level), __FUNCTION__, __LINE__, text, ##__VA_ARGS__);}while(0);
+
+#define ERROR(text, ...) LOG(RUSBCTRL_LOG_ERROR, text, ##__VA_ARGS__)
+#define WARN(text, ...) LOG(RUSBCTRL_LOG_WARN, text, ##__VA_ARGS__)
+#define INFO(text, ...) LOG(RUSBCTRL_LOG_INFO, text, ##__VA_ARGS__)
+#define DEBUG(text, ...) LOG(RUSBCTRL_LOG_DEBUG, text, ##__VA_ARGS__)
+
+#endif /* _USBCTRL_LOG_H_ */
@@ -0,0 +1,489 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "usbctrl_prefetch.h"
+#include "usbctrl_log.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <atomic>
+#include "pthread.h"
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+/* IORING_OP_OPENAT, IORING_OP_CLOSE and the opcode probe arrived in Linux 5.6, together with this feature flag. */
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_CUR_PERSONALITY)
+#define USBCTRL_USE_IO_URING 1
+#endif
+#endif
+
+static const size_t PREFETCH_FILES_PER_THREAD = 16;
+static const size_t MAX_PREFETCH_THREADS = 4;
+
+/* Only descriptor blobs of unusually complex devices outgrow their first read. */
+static void read_remainder(int fd, prefetch_request &request)
+{
+	char buffer[4096];
+	ssize_t ret;
+	while(0 < (ret = pread(fd, buffer, sizeof(buffer), request.value.size())))
+	{
+		request.value.append(buffer, ret);
+	}
+}
+
+static void read_file(prefetch_request &request)
+{
+	int fd = open(request.path.c_str(), O_RDONLY | O_CLOEXEC);
+	if(0 > fd)
+	{
+		request.error = errno;
+		return;
+	}
+	request.value.resize(request.max_size);
+	ssize_t ret = pread(fd, &request.value[0], request.max_size, 0);
+	if(0 <= ret)
+	{
+		request.present = true;
+		request.value.resize(ret);
+		if((size_t)ret == request.max_size)
+		{
+			read_remainder(fd, request);
+		}
+	}
+	else
+	{
+		request.error = errno;
+		request.value.clear();
+	}
+	close(fd);
+}
+
+struct prefetch_batch
+{
+	std::vector<prefetch_request> *requests;
+	std::atomic<size_t> next;
+};
+
+static void * prefetch_worker(void *data)
+{
+	prefetch_batch *batch = (prefetch_batch *)data;
+	size_t index;
+	while((index = batch->next.fetch_add(1, std::memory_order_relaxed)) < batch->requests->size())
+	{
+		read_file((*batch->requests)[index]);
+	}
+	return NULL;
+}
+
+static void prefetch_with_threads(std::vector<prefetch_request> &requests)
+{
+	prefetch_batch batch;
+	batch.requests = &requests;
+	batch.next.store(0);
+	/* The calling thread is one of the workers, so a single device's attributes don't start any threads. sysfs reads
+	 * rarely block, so more threads than CPUs would only add the cost of starting them. */
+	size_t count = (requests.size() + PREFETCH_FILES_PER_THREAD - 1) / PREFETCH_FILES_PER_THREAD;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t limit = ((1 > cpus) ? 1 : ((size_t)cpus > MAX_PREFETCH_THREADS ? MAX_PREFETCH_THREADS : (size_t)cpus));
+	count = (count > limit ? limit : count);
+	pthread_t threads[MAX_PREFETCH_THREADS];
+	size_t started;
+	for(started = 0; (started + 1) < count; started++)
+	{
+		if(0 != pthread_create(&threads[started], NULL, prefetch_worker, &batch))
+		{
+			break;
+		}
+	}
+	prefetch_worker(&batch);
+	for(size_t i = 0; i < started; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+}
+
+#ifdef USBCTRL_USE_IO_URING
+static const unsigned int RING_ENTRIES = 64;
+
+/* Just enough of io_uring to run batches of openat, read and close, without depending on liburing. */
+class uring_batch
+{
+	private:
+	int m_fd;
+	unsigned char *m_sq_ring;
+	size_t m_sq_ring_size;
+	unsigned char *m_cq_ring;
+	size_t m_cq_ring_size;
+	struct io_uring_sqe *m_sqes;
+	size_t m_sqes_size;
+	unsigned int m_entries;
+	unsigned int *m_sq_tail;
+	unsigned int *m_sq_mask;
+	unsigned int *m_sq_array;
+	unsigned int *m_cq_head;
+	unsigned int *m_cq_tail;
+	unsigned int *m_cq_mask;
+	struct io_uring_cqe *m_cqes;
+	unsigned int m_tail;
+	unsigned int m_queued;
+	unsigned int m_unsubmitted;
+	unsigned int m_in_flight;
+	/* Read buffers that operations still in flight may write to, kept alive for as long as the ring is. */
+	std::vector<std::string> m_orphaned_buffers;
+
+	public:
+	uring_batch() : m_fd(-1), m_sq_ring(NULL), m_sq_ring_size(0), m_cq_ring(NULL), m_cq_ring_size(0), m_sqes(NULL),
+		m_sqes_size(0), m_entries(0), m_tail(0), m_queued(0), m_unsubmitted(0), m_in_flight(0)
+	{
+	}
+
+	~uring_batch()
+	{
+		if(NULL != m_sqes)
+		{
+			munmap(m_sqes, m_sqes_size);
+		}
+		if((NULL != m_cq_ring) && (m_cq_ring != m_sq_ring))
+		{
+			munmap(m_cq_ring, m_cq_ring_size);
+		}
+		if(NULL != m_sq_ring)
+		{
+			munmap(m_sq_ring, m_sq_ring_size);
+		}
+		if(0 <= m_fd)
+		{
+			close(m_fd);
+		}
+	}
+
+	bool init(unsigned int entries)
+	{
+		struct io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		m_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+		if(0 > m_fd)
+		{
+			INFO("io_uring is not available (%s).\n", strerror(errno));
+			return false;
+		}
+		m_entries = params.sq_entries;
+		m_sq_ring_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned int));
+		m_cq_ring_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+		if(params.features & IORING_FEAT_SINGLE_MMAP)
+		{
+			m_sq_ring_size = m_cq_ring_size = (m_sq_ring_size > m_cq_ring_size ? m_sq_ring_size : m_cq_ring_size);
+		}
+		m_sq_ring = (unsigned char *)map(m_sq_ring_size, IORING_OFF_SQ_RING);
+		if(NULL == m_sq_ring)
+		{
+			return false;
+		}
+		m_cq_ring = ((params.features & IORING_FEAT_SINGLE_MMAP) ? m_sq_ring : (unsigned char *)map(m_cq_ring_size, IORING_OFF_CQ_RING));
+		m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+		m_sqes = (struct io_uring_sqe *)map(m_sqes_size, IORING_OFF_SQES);
+		if((NULL == m_cq_ring) || (NULL == m_sqes))
+		{
+			return false;
+		}
+		m_sq_tail = (unsigned int *)(m_sq_ring + params.sq_off.tail);
+		m_sq_mask = (unsigned int *)(m_sq_ring + params.sq_off.ring_mask);
+		m_sq_array = (unsigned int *)(m_sq_ring + params.sq_off.array);
+		m_cq_head = (unsigned int *)(m_cq_ring + params.cq_off.head);
+		m_cq_tail = (unsigned int *)(m_cq_ring + params.cq_off.tail);
+		m_cq_mask = (unsigned int *)(m_cq_ring + params.cq_off.ring_mask);
+		m_cqes = (struct io_uring_cqe *)(m_cq_ring + params.cq_off.cqes);
+		m_tail = *m_sq_tail;
+		return supports_file_operations();
+	}
+
+	inline unsigned int capacity() const {return m_entries;}
+	/* True if no operation submitted to the kernel is still outstanding, so the ring can be torn down. */
+	inline bool is_idle() const {return (0 == m_in_flight);}
+
+	/* The entry is published by submit_and_wait(), so the caller can still fill in the operation's arguments. */
+	struct io_uring_sqe * queue(uint8_t opcode, int fd, unsigned int index)
+	{
+		unsigned int slot = m_tail & *m_sq_mask;
+		struct io_uring_sqe *sqe = &m_sqes[slot];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = opcode;
+		sqe->fd = fd;
+		sqe->user_data = index;
+		m_sq_array[slot] = slot;
+		m_tail++;
+		m_queued++;
+		return sqe;
+	}
+
+	/* Submits everything queued and waits for all of it. results is indexed by the index passed to queue(). */
+	bool submit_and_wait(std::vector<int> &results)
+	{
+		__atomic_store_n(m_sq_tail, m_tail, __ATOMIC_RELEASE);
+		m_unsubmitted += m_queued;
+		m_queued = 0;
+		return wait(results, true);
+	}
+
+	/* After submit_and_wait() failed: waits for the operations the kernel has already taken, without submitting the
+	 * rest. Returns false if even that fails, in which case is_idle() tells whether anything is still outstanding. */
+	bool drain(std::vector<int> &results)
+	{
+		return wait(results, false);
+	}
+
+	/* Takes over a buffer that an outstanding read may still write to. */
+	void adopt_buffer(std::string &buffer)
+	{
+		m_orphaned_buffers.push_back(std::string());
+		m_orphaned_buffers.back().swap(buffer);
+	}
+
+	private:
+	bool wait(std::vector<int> &results, bool submit)
+	{
+		while((0 < m_in_flight) || ((submit) && (0 < m_unsubmitted)))
+		{
+			unsigned int to_submit = (submit ? m_unsubmitted : 0);
+			int ret = (int)syscall(__NR_io_uring_enter, m_fd, to_submit, m_in_flight + to_submit, IORING_ENTER_GETEVENTS, NULL, 0);
+			if(0 <= ret)
+			{
+				unsigned int submitted = ((unsigned int)ret < to_submit ? (unsigned int)ret : to_submit);
+				m_unsubmitted -= submitted;
+				m_in_flight += submitted;
+			}
+			/* Reap even on failure: EBUSY means the completion queue needs room. */
+			unsigned int head = *m_cq_head;
+			unsigned int tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+			for(; head != tail; head++)
+			{
+				const struct io_uring_cqe *cqe = &m_cqes[head & *m_cq_mask];
+				results[cqe->user_data] = cqe->res;
+				m_in_flight--;
+			}
+			__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+			if((0 > ret) && (EINTR != errno) && (EAGAIN != errno) && (EBUSY != errno))
+			{
+				ERROR("io_uring_enter failed (%s).\n", strerror(errno));
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void * map(size_t size, unsigned long long offset)
+	{
+		void *address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+		return (MAP_FAILED == address ? NULL : address);
+	}
+
+	bool supports_file_operations()
+	{
+		size_t size = sizeof(struct io_uring_probe) + (IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+		struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, size);
+		bool supported = false;
+		if((NULL != probe) && (0 == syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST)))
+		{
+			supported = (is_supported(probe, IORING_OP_OPENAT) && is_supported(probe, IORING_OP_READ) &&
+				is_supported(probe, IORING_OP_CLOSE));
+		}
+		free(probe);
+		if(!supported)
+		{
+			INFO("io_uring does not support file operations on this kernel.\n");
+		}
+		return supported;
+	}
+
+	static bool is_supported(const struct io_uring_probe *probe, int opcode)
+	{
+		return ((opcode <= probe->last_op) && (0 != (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)));
+	}
+};
+
+/* What results holds for an operation that never completed; a cancelled one reports the same. */
+static const int NOT_COMPLETED = -ECANCELED;
+
+static void close_files(const std::vector<int> &fds, size_t count)
+{
+	for(size_t i = 0; i < count; i++)
+	{
+		if(0 <= fds[i])
+		{
+			close(fds[i]);
+		}
+	}
+}
+
+/* Three round trips per chunk of files, however many files there are: open them all, read them all, close them all.
+ * On failure no file of the chunk is left open, and nothing in flight writes to a buffer the caller still owns. */
+static bool prefetch_with_ring(uring_batch &ring, std::vector<prefetch_request> &requests)
+{
+	std::vector<int> results(ring.capacity());
+	std::vector<int> fds(ring.capacity());
+	for(size_t first = 0; first < requests.size(); first += ring.capacity())
+	{
+		size_t count = requests.size() - first;
+		count = (count > ring.capacity() ? ring.capacity() : count);
+		for(size_t i = 0; i < count; i++)
+		{
+			results[i] = NOT_COMPLETED;
+			struct io_uring_sqe *sqe = ring.queue(IORING_OP_OPENAT, AT_FDCWD, i);
+			sqe->addr = (uintptr_t)requests[first + i].path.c_str();
+			sqe->open_flags = O_RDONLY | O_CLOEXEC;
+		}
+		if(!ring.submit_and_wait(results))
+		{
+			/* Opens still outstanding if this fails too are lost with the ring; the completed ones are closed here. */
+			ring.drain(results);
+			close_files(results, count);
+			return false;
+		}
+		for(size_t i = 0; i < count; i++)
+		{
+			fds[i] = results[i];
+			if(0 <= fds[i])
+			{
+				prefetch_request &request = requests[first + i];
+				request.value.resize(request.max_size);
+				struct io_uring_sqe *sqe = ring.queue(IORING_OP_READ, fds[i], i);
+				sqe->addr = (uintptr_t)&request.value[0];
+				sqe->len = request.max_size;
+				sqe->off = 0;
+			}
+		}
+		if(!ring.submit_and_wait(results))
+		{
+			ring.drain(results);
+			for(size_t i = 0; (!ring.is_idle()) && (i < count); i++)
+			{
+				if(0 <= fds[i])
+				{
+					/* The read sizes keep these past the small string buffer, so the memory moves with them. */
+					ring.adopt_buffer(requests[first + i].value);
+				}
+			}
+			close_files(fds, count);
+			return false;
+		}
+		for(size_t i = 0; i < count; i++)
+		{
+			prefetch_request &request = requests[first + i];
+			if(0 > fds[i])
+			{
+				request.error = -fds[i];
+				continue;
+			}
+			if(0 <= results[i])
+			{
+				request.present = true;
+				request.value.resize(results[i]);
+				if((size_t)results[i] == request.max_size)
+				{
+					read_remainder(fds[i], request);
+				}
+			}
+			else
+			{
+				request.error = -results[i];
+				request.value.clear();
+			}
+			results[i] = NOT_COMPLETED;
+			ring.queue(IORING_OP_CLOSE, fds[i], i);
+		}
+		if(!ring.submit_and_wait(results))
+		{
+			/* Once drained, the closes that never ran can be done here. Otherwise one of them may still run, and
+			 * closing its fd again could hit a reused one, so those leak. */
+			if(ring.drain(results))
+			{
+				for(size_t i = 0; i < count; i++)
+				{
+					fds[i] = ((NOT_COMPLETED == results[i]) ? fds[i] : -1);
+				}
+				close_files(fds, count);
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Set up on first use and only torn down after a failure: the monitor thread may still be prefetching during static
+ * destruction. */
+static uring_batch *ring = NULL;
+static bool ring_checked = false;
+#endif
+
+const char * usbctrl_prefetch(std::vector<prefetch_request> &requests)
+{
+#ifdef USBCTRL_USE_IO_URING
+	if(requests.empty())
+	{
+		return "nothing";
+	}
+	pthread_mutex_lock(&ring_mutex);
+	if(!ring_checked)
+	{
+		ring_checked = true;
+		/* RUSBCTRL_PREFETCH=threads forces the fallback, to compare the two. */
+		const char *env = getenv("RUSBCTRL_PREFETCH");
+		if((NULL == env) || (0 != strcmp(env, "threads")))
+		{
+			ring = new uring_batch;
+			if(!ring->init(RING_ENTRIES))
+			{
+				delete ring;
+				ring = NULL;
+			}
+		}
+	}
+	bool done = ((NULL != ring) && prefetch_with_ring(*ring, requests));
+	if((NULL != ring) && (!done))
+	{
+		/* Don't use the ring again. Tear it down unless operations are still outstanding; then it keeps their buffers. */
+		ERROR("io_uring prefetch failed. Falling back to threads.\n");
+		if(ring->is_idle())
+		{
+			delete ring;
+		}
+		ring = NULL;
+	}
+	pthread_mutex_unlock(&ring_mutex);
+	if(done)
+	{
+		return "io_uring";
+	}
+	for(size_t i = 0; i < requests.size(); i++)
+	{
+		requests[i].value.clear();
+		requests[i].present = false;
+		requests[i].error = 0;
+	}
+#endif
+	prefetch_with_threads(requests);
+	return "threads";
+}
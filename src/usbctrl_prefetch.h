@@ -0,0 +1,44 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _USBCTRL_PREFETCH_H_
+#define _USBCTRL_PREFETCH_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/* One sysfs file to read as part of a batch. value receives the raw contents, newline included. When the file is not
+ * present, error holds the errno of the open or read that failed; ENOENT means the attribute does not exist. */
+struct prefetch_request
+{
+	std::string path;
+	size_t max_size;
+	std::string value;
+	bool present;
+	int error;
+
+	prefetch_request(const std::string &file_path, size_t size) : path(file_path), max_size(size), present(false), error(0) {}
+};
+
+/* Reads all files of the batch together: through io_uring where the kernel supports it, so that the whole batch
+ * costs a handful of system calls, otherwise on a few threads doing plain reads. Files that cannot be opened or read
+ * are left not present, with their error set. Returns the name of the method used, for logging. */
+const char * usbctrl_prefetch(std::vector<prefetch_request> &requests);
+
+#endif /* _USBCTRL_PREFETCH_H_ */
@@ -0,0 +1,178 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+/*
+ * usb_descriptors::parse() against well-formed and malformed "descriptors" blobs.
+ *
+ * The blobs come from sysfs, so the parser must never read past the end and must keep whatever was valid
+ * before the first malformed descriptor.
+ */
+#include "usbctrl_descriptors.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool condition, const char *what)
+{
+	if(!condition)
+	{
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static const uint8_t device_descriptor[] = {
+	0x12, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x40, 0x6b, 0x1d, 0x04, 0x01, 0x10, 0x00, 0x01, 0x02, 0x03, 0x01};
+static const uint8_t config_descriptor[] = {0x09, 0x02, 0x27, 0x00, 0x01, 0x01, 0x00, 0xe0, 0x32};
+static const uint8_t interface_descriptor[] = {0x09, 0x04, 0x00, 0x00, 0x02, 0x08, 0x06, 0x50, 0x00};
+static const uint8_t bulk_in_descriptor[] = {0x07, 0x05, 0x81, 0x02, 0x00, 0x02, 0x00};
+/* High-bandwidth isochronous OUT, 2 additional transactions. */
+static const uint8_t iso_out_descriptor[] = {0x07, 0x05, 0x02, 0x01, 0x00, 0x14, 0x01};
+/* Reserved value 3 in the additional transactions bits. */
+static const uint8_t reserved_descriptor[] = {0x07, 0x05, 0x83, 0x03, 0x00, 0x1c, 0x01};
+
+static void append(std::vector<uint8_t> &blob, const uint8_t *descriptor, size_t size)
+{
+	blob.insert(blob.end(), descriptor, descriptor + size);
+}
+
+static std::vector<uint8_t> well_formed_blob()
+{
+	std::vector<uint8_t> blob;
+	append(blob, device_descriptor, sizeof(device_descriptor));
+	append(blob, config_descriptor, sizeof(config_descriptor));
+	append(blob, interface_descriptor, sizeof(interface_descriptor));
+	append(blob, bulk_in_descriptor, sizeof(bulk_in_descriptor));
+	append(blob, iso_out_descriptor, sizeof(iso_out_descriptor));
+	return blob;
+}
+
+static void test_well_formed()
+{
+	std::vector<uint8_t> blob = well_formed_blob();
+	usb_descriptors descriptors;
+	check(descriptors.parse(&blob[0], blob.size()), "well-formed blob parses");
+	check(descriptors.is_valid(), "well-formed blob is valid");
+	check(0x1d6b == descriptors.get_device().vendorId, "vendor id");
+	check(0x0104 == descriptors.get_device().productId, "product id");
+	check(0x0200 == descriptors.get_device().bcdUSB, "bcdUSB");
+	check(1 == descriptors.get_device().numConfigurations, "configuration count");
+
+	const usb_descriptors::config_info *config = descriptors.get_config(0);
+	check((NULL != config) && (1 == config->descriptor.numInterfaces), "one interface");
+	check((NULL != config) && (100 == config->descriptor.maxPowerMilliAmps), "max power in 2 mA units");
+	check((NULL != config) && (1 == config->descriptor.selfPowered) && (1 == config->descriptor.remoteWakeup), "attributes");
+	check(NULL == descriptors.get_config(1), "no second configuration");
+
+	const rusbCtrl_endpointDescriptor_t *endpoint = descriptors.get_endpoint(0, 0, 0);
+	check((NULL != endpoint) && (0x81 == endpoint->address) && (1 == endpoint->directionIn), "bulk in address");
+	check((NULL != endpoint) && (512 == endpoint->maxPacketSize) && (1 == endpoint->transactionsPerMicroframe), "bulk in size");
+	endpoint = descriptors.get_endpoint(0, 0, 1);
+	check((NULL != endpoint) && (1024 == endpoint->maxPacketSize) && (3 == endpoint->transactionsPerMicroframe), "iso out size");
+	check(NULL == descriptors.get_endpoint(0, 0, 2), "no third endpoint");
+	check(NULL == descriptors.get_endpoint(0, 0, -1), "negative index");
+
+	std::vector<uint8_t> classes;
+	descriptors.get_interface_classes(classes);
+	check((1 == classes.size()) && (0x08 == classes[0]), "interface classes");
+
+	descriptors.set_super_speed();
+	config = descriptors.get_config(0);
+	check((NULL != config) && (400 == config->descriptor.maxPowerMilliAmps), "max power in 8 mA units");
+}
+
+static void test_zero_length()
+{
+	usb_descriptors descriptors;
+	uint8_t unused = 0;
+	check(!descriptors.parse(NULL, 0), "NULL blob is rejected");
+	check(!descriptors.parse(&unused, 0), "zero-length blob is rejected");
+	check(!descriptors.is_valid(), "zero-length blob is invalid");
+	check(NULL == descriptors.get_config(0), "zero-length blob has no configuration");
+}
+
+static void test_truncated()
+{
+	std::vector<uint8_t> blob = well_formed_blob();
+	usb_descriptors descriptors;
+	check(!descriptors.parse(&blob[0], sizeof(device_descriptor) - 1), "truncated device descriptor is rejected");
+	check(!descriptors.is_valid(), "truncated device descriptor is invalid");
+
+	/* Every cut must parse without reading past the end, keeping the complete descriptors before it. */
+	for(size_t size = sizeof(device_descriptor); size < blob.size(); size++)
+	{
+		std::vector<uint8_t> cut(blob.begin(), blob.begin() + size);
+		check(descriptors.parse(&cut[0], cut.size()), "truncated blob keeps the device descriptor");
+	}
+
+	size_t first_endpoint_end = sizeof(device_descriptor) + sizeof(config_descriptor) + sizeof(interface_descriptor) +
+		sizeof(bulk_in_descriptor);
+	std::vector<uint8_t> cut(blob.begin(), blob.begin() + first_endpoint_end + 3);
+	check(descriptors.parse(&cut[0], cut.size()), "blob cut inside an endpoint parses");
+	check(NULL != descriptors.get_endpoint(0, 0, 0), "endpoint before the cut is kept");
+	check(NULL == descriptors.get_endpoint(0, 0, 1), "endpoint across the cut is dropped");
+
+	/* A zero bLength would otherwise loop forever. */
+	cut.assign(blob.begin(), blob.begin() + sizeof(device_descriptor) + sizeof(config_descriptor));
+	cut.push_back(0x00);
+	cut.push_back(0x04);
+	append(cut, interface_descriptor, sizeof(interface_descriptor));
+	check(descriptors.parse(&cut[0], cut.size()), "zero bLength parses");
+	check(NULL == descriptors.get_interface(0, 0), "nothing after a zero bLength is used");
+
+	/* Reusing the object must not keep anything from the previous blob. */
+	std::vector<uint8_t> garbage(blob.begin(), blob.begin() + 4);
+	check(!descriptors.parse(&garbage[0], garbage.size()), "garbage is rejected after a valid blob");
+	check(NULL == descriptors.get_config(0), "configurations are cleared");
+}
+
+static void test_out_of_order()
+{
+	std::vector<uint8_t> blob;
+	append(blob, device_descriptor, sizeof(device_descriptor));
+	append(blob, bulk_in_descriptor, sizeof(bulk_in_descriptor));
+	append(blob, interface_descriptor, sizeof(interface_descriptor));
+	append(blob, config_descriptor, sizeof(config_descriptor));
+	append(blob, bulk_in_descriptor, sizeof(bulk_in_descriptor));
+	append(blob, interface_descriptor, sizeof(interface_descriptor));
+	append(blob, reserved_descriptor, sizeof(reserved_descriptor));
+
+	usb_descriptors descriptors;
+	check(descriptors.parse(&blob[0], blob.size()), "out-of-order blob parses");
+	const usb_descriptors::config_info *config = descriptors.get_config(0);
+	check((NULL != config) && (1 == config->interfaces.size()), "interface before any configuration is ignored");
+	const usb_descriptors::interface_info *interface = descriptors.get_interface(0, 0);
+	check((NULL != interface) && (1 == interface->endpoints.size()), "endpoint before any interface is ignored");
+
+	const rusbCtrl_endpointDescriptor_t *endpoint = descriptors.get_endpoint(0, 0, 0);
+	check((NULL != endpoint) && (0x83 == endpoint->address), "endpoint after the interface is kept");
+	check((NULL != endpoint) && (3 == endpoint->transactionsPerMicroframe), "reserved transactions value is clamped");
+}
+
+int main()
+{
+	test_well_formed();
+	test_zero_length();
+	test_truncated();
+	test_out_of_order();
+	printf("%s\n", (0 == failures ? "PASS" : "FAIL"));
+	return (0 == failures ? 0 : 1);
+}
@@ -0,0 +1,281 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+/*
+ * Hotplug storm vs. concurrent readers.
+ *
+ * An injector thread pushes synthetic add/remove events through the same code path the monitor thread uses,
+ * while reader threads query properties, walk the device list through the C++ API and a churn thread keeps
+ * re-registering the callback, re-subscribing, waiting for devices and calling rusbCtrl_term(). Built with
+ * ThreadSanitizer, any unsynchronized access in the library fails the run; the thresholds below catch
+ * throughput and latency regressions.
+ */
+#include "usbctrl.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "pthread.h"
+
+/* Provided by usbctrl.cpp when built with USBCTRL_SYNTHETIC_EVENTS. */
+void usbctrl_inject_event(int inserted, const char *devnode);
+
+static const int DEVICE_SLOTS = 32;
+static const int MAX_READERS = 64;
+
+static int run_seconds = 5;
+static int reader_count = 8;
+static double min_events_per_sec = 1000;
+static double max_p99_usecs = 5000;
+static double max_contention_percent = 50;
+
+static std::atomic<bool> running(true);
+static std::atomic<int> last_seen_id(0);
+static std::atomic<unsigned long> callbacks_seen(0);
+static char devnodes[DEVICE_SLOTS][32];
+
+static inline unsigned long long now_nsecs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((unsigned long long)now.tv_sec * 1000000000ULL) + now.tv_nsec;
+}
+
+struct latency_samples
+{
+	std::vector<unsigned int> nsecs;
+	unsigned long operations;
+	latency_samples() : operations(0) {nsecs.reserve(1 << 20);}
+	void add(unsigned long long start)
+	{
+		operations++;
+		if(nsecs.size() < nsecs.capacity())
+		{
+			nsecs.push_back((unsigned int)(now_nsecs() - start));
+		}
+	}
+};
+
+void callback(int id, int connected, void *data)
+{
+	callbacks_seen.fetch_add(1, std::memory_order_relaxed);
+	if(connected)
+	{
+		last_seen_id.store(id, std::memory_order_relaxed);
+	}
+}
+
+static void * injector_thread(void *data)
+{
+	latency_samples *samples = (latency_samples *)data;
+	bool present[DEVICE_SLOTS] = {false};
+	unsigned int seed = 1;
+	while(running.load(std::memory_order_relaxed))
+	{
+		int slot = rand_r(&seed) % DEVICE_SLOTS;
+		unsigned long long start = now_nsecs();
+		usbctrl_inject_event(!present[slot], devnodes[slot]);
+		samples->add(start);
+		present[slot] = !present[slot];
+	}
+	for(int slot = 0; slot < DEVICE_SLOTS; slot++)
+	{
+		if(present[slot])
+		{
+			usbctrl_inject_event(0, devnodes[slot]);
+		}
+	}
+	return NULL;
+}
+
+static void * reader_thread(void *data)
+{
+	latency_samples *samples = (latency_samples *)data;
+	unsigned int seed = (unsigned int)(unsigned long)data;
+	static const char *properties[] = {"idVendor", "product", "serial", "speed", "busnum"};
+	while(running.load(std::memory_order_relaxed))
+	{
+		/* Aim near the newest ids so that most lookups race against live records. */
+		int id = last_seen_id.load(std::memory_order_relaxed) - (rand_r(&seed) % DEVICE_SLOTS);
+		unsigned long long start = now_nsecs();
+		char *value = rusbCtrl_getProperty(id, properties[rand_r(&seed) % 5]);
+		uint16_t vendor_id;
+		rusbCtrl_getVendorId(id, &vendor_id);
+		samples->add(start);
+		free(value);
+
+		if(0 == (samples->operations % 64))
+		{
+			/* Hold references across removals; the views must stay readable. */
+			size_t length = 0;
+			for(const usbctrl::device &dev : usbctrl::devices())
+			{
+				length += dev.product().size() + dev.serial().size();
+			}
+			(void)length;
+		}
+	}
+	return NULL;
+}
+
+static void * churn_thread(void *data)
+{
+	latency_samples *samples = (latency_samples *)data;
+	while(running.load(std::memory_order_relaxed))
+	{
+		int *device_list = NULL;
+		int device_list_size = 0;
+		unsigned long long start = now_nsecs();
+		rusbCtrl_registerCallback(callback, NULL, &device_list, &device_list_size);
+		samples->add(start);
+		if(0 != device_list_size)
+		{
+			free(device_list);
+		}
+		usbctrl::subscription events([](int id, bool inserted) {
+			usbctrl::device dev(id);
+			(void)dev.vendor_id();
+		});
+		rusbCtrl_deviceMatch_t any = {0};
+		int waited_id;
+		rusbCtrl_waitForDevice(&any, 1, &waited_id);
+		usleep(1000);
+		events.reset();
+		rusbCtrl_term();
+	}
+	return NULL;
+}
+
+static double percentile_usecs(std::vector<unsigned int> &nsecs, double percentile)
+{
+	if(nsecs.empty())
+	{
+		return 0;
+	}
+	size_t index = (size_t)((nsecs.size() - 1) * percentile);
+	return nsecs[index] / 1000.0;
+}
+
+static void report(const char *name, std::vector<latency_samples *> &samples, double seconds, double &p99)
+{
+	std::vector<unsigned int> all;
+	unsigned long operations = 0;
+	for(size_t i = 0; i < samples.size(); i++)
+	{
+		all.insert(all.end(), samples[i]->nsecs.begin(), samples[i]->nsecs.end());
+		operations += samples[i]->operations;
+	}
+	std::sort(all.begin(), all.end());
+	p99 = percentile_usecs(all, 0.99);
+	printf("%-10s %10.0f ops/s  p50 %8.1fus  p99 %8.1fus  p99.9 %8.1fus  max %8.1fus\n", name, operations / seconds,
+		percentile_usecs(all, 0.5), p99, percentile_usecs(all, 0.999), percentile_usecs(all, 1.0));
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-t seconds] [-r readers] [-e min events/s] [-l max p99 us] [-c max lock contention %%]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	int option;
+	while(-1 != (option = getopt(argc, argv, "t:r:e:l:c:h")))
+	{
+		switch(option)
+		{
+			case 't': run_seconds = atoi(optarg); break;
+			case 'r': reader_count = std::min(atoi(optarg), MAX_READERS); break;
+			case 'e': min_events_per_sec = atof(optarg); break;
+			case 'l': max_p99_usecs = atof(optarg); break;
+			case 'c': max_contention_percent = atof(optarg); break;
+			default: usage(argv[0]); return 2;
+		}
+	}
+	for(int slot = 0; slot < DEVICE_SLOTS; slot++)
+	{
+		snprintf(devnodes[slot], sizeof(devnodes[slot]), "/dev/bus/usb/%03d/%03d", 1 + (slot / 8), 1 + slot);
+	}
+
+	rusbCtrl_setLogLevel(RUSBCTRL_LOG_WARN);
+	rusbCtrl_init();
+	rusbCtrl_registerCallback(callback, NULL, NULL, NULL);
+
+	latency_samples injector_samples, churn_samples;
+	std::vector<latency_samples *> reader_samples;
+	pthread_t injector, churn, readers[MAX_READERS];
+	unsigned long long start = now_nsecs();
+	pthread_create(&injector, NULL, injector_thread, &injector_samples);
+	pthread_create(&churn, NULL, churn_thread, &churn_samples);
+	for(int i = 0; i < reader_count; i++)
+	{
+		reader_samples.push_back(new latency_samples);
+		pthread_create(&readers[i], NULL, reader_thread, reader_samples[i]);
+	}
+
+	sleep(run_seconds);
+	running.store(false);
+	pthread_join(injector, NULL);
+	pthread_join(churn, NULL);
+	for(int i = 0; i < reader_count; i++)
+	{
+		pthread_join(readers[i], NULL);
+	}
+	double seconds = (now_nsecs() - start) / 1e9;
+
+	rusbCtrl_stats_t stats;
+	rusbCtrl_getStats(&stats);
+	rusbCtrl_term();
+
+	std::vector<latency_samples *> injector_list(1, &injector_samples), churn_list(1, &churn_samples);
+	double injector_p99, reader_p99, churn_p99;
+	printf("%d readers, %.1fs, %lu callbacks\n", reader_count, seconds, callbacks_seen.load());
+	report("events", injector_list, seconds, injector_p99);
+	report("reads", reader_samples, seconds, reader_p99);
+	report("register", churn_list, seconds, churn_p99);
+	double contention = (0 != stats.recordLockAcquisitions ?
+		(100.0 * stats.recordLockContentions / stats.recordLockAcquisitions) : 0);
+	printf("record lock: %lu acquisitions, %lu contended (%.1f%%)\n", stats.recordLockAcquisitions,
+		stats.recordLockContentions, contention);
+
+	int result = 0;
+	if((injector_samples.operations / seconds) < min_events_per_sec)
+	{
+		printf("FAIL: event throughput below %.0f/s\n", min_events_per_sec);
+		result = 1;
+	}
+	if((injector_p99 > max_p99_usecs) || (reader_p99 > max_p99_usecs))
+	{
+		printf("FAIL: p99 latency above %.0fus\n", max_p99_usecs);
+		result = 1;
+	}
+	if(contention > max_contention_percent)
+	{
+		printf("FAIL: record lock contention above %.0f%%\n", max_contention_percent);
+		result = 1;
+	}
+	for(int i = 0; i < reader_count; i++)
+	{
+		delete reader_samples[i];
+	}
+	printf("%s\n", (0 == result ? "PASS" : "FAIL"));
+	return result;
+}
@@ -20,7 +20,11 @@
 #include "usbctrl.h"
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <list>
+#include <vector>
+#include <algorithm>
 
 static std::list<int> connected_device_ids;
 void callback(int id, int connected, void *data)
@@ -32,6 +36,11 @@ void callback(int id, int connected, void *data)
 		std::cout<<"device "<<id<<" is connected\n";
 		std::cout<<"Product: "<<prop<<std::endl;
         free((void *)prop);
+		uint16_t vendor_id, product_id;
+		if((0 == rusbCtrl_getVendorId(id, &vendor_id)) && (0 == rusbCtrl_getProductId(id, &product_id)))
+		{
+			std::cout<<"VID:PID: "<<std::hex<<vendor_id<<":"<<product_id<<std::dec<<std::endl;
+		}
 		connected_device_ids.push_back(id);
 	}
 	else
@@ -54,7 +63,25 @@ void print_menu(void)
 	std::cout<<"3. rusbCtrl_registerCallback()\n";
 	std::cout<<"4. rusbCtrl_getProperty()\n";
 	std::cout<<"5. List hot-plugged dev_ids (not thread-safe).\n";
-	std::cout<<"9. Quit.\n";
+	std::cout<<"6. rusbCtrl_addPolicyRule()\n";
+	std::cout<<"7. rusbCtrl_clearPolicyRules()\n";
+	std::cout<<"8. rusbCtrl_getStats()\n";
+	std::cout<<"9. rusbCtrl_waitForDevice()\n";
+	std::cout<<"10. Dump USB descriptors.\n";
+	std::cout<<"11. Toggle rusbCtrl_enableEarlyNotification()\n";
+	std::cout<<"12. Quit.\n";
+}
+
+void event_callback(const rusbCtrl_event_t *event, void *data)
+{
+	if(RUSBCTRL_EVENT_ARRIVING == event->type)
+	{
+		printf("Arriving: %04x:%04x at %s\n", event->vendorId, event->productId, event->syspath);
+	}
+	else
+	{
+		printf("Ready: dev_id %d at %s, %luus after arrival\n", event->devId, event->syspath, event->elapsedUsecs);
+	}
 }
 
 static std::string callback_payload = "Uninitialized";
@@ -161,7 +188,129 @@ void launcher()
 					dump_connected_devices();
 					break;
 				}
+			case 6:
+				{
+					std::cout<<"Enter action (0 allow, 1 deny), vendor id and product id in hex separated by spaces.\n";
+					int action;
+					rusbCtrl_deviceMatch_t match = {0};
+					unsigned int vendor, product;
+					if(!(std::cin>>action>>std::hex>>vendor>>product>>std::dec))
+					{
+						std::cout<<"Whoops! Bad input.\n";
+						std::cin.clear();
+						std::cin.ignore(10000, '\n');
+					}
+					else
+					{
+						match.flags = RUSBCTRL_MATCH_VENDOR | RUSBCTRL_MATCH_PRODUCT;
+						match.vendorId = vendor;
+						match.productId = product;
+						if(0 != rusbCtrl_addPolicyRule(&match, (action ? RUSBCTRL_POLICY_DENY : RUSBCTRL_POLICY_ALLOW)))
+						{
+							std::cout<<"Failed to add rule.\n";
+						}
+					}
+					break;
+				}
+			case 7:
+				rusbCtrl_clearPolicyRules();
+				break;
+			case 8:
+				{
+					rusbCtrl_stats_t stats;
+					if(0 == rusbCtrl_getStats(&stats))
+					{
+						std::cout<<"Policy decisions: "<<stats.policyDecisions<<", denied: "<<stats.policyDenied<<std::endl;
+						std::cout<<"Policy decision latency (us): last "<<stats.policyLastDecisionUsecs<<", max "<<stats.policyMaxDecisionUsecs
+							<<", avg "<<(stats.policyDecisions ? stats.policyTotalDecisionUsecs / stats.policyDecisions : 0)<<std::endl;
+						std::cout<<"Early notification latency (us): arriving last "<<stats.earlyLastUsecs<<", max "<<stats.earlyMaxUsecs
+							<<" ("<<stats.earlyEvents<<" events); ready last "<<stats.readyLastUsecs<<", max "<<stats.readyMaxUsecs
+							<<", avg "<<(stats.readyEvents ? stats.readyTotalUsecs / stats.readyEvents : 0)<<std::endl;
+						std::cout<<"Enumeration: "<<stats.enumeratedDevices<<" devices in "<<stats.enumerationUsecs<<"us, sysfs prefetch "
+							<<stats.enumerationPrefetchUsecs<<"us"<<std::endl;
+					}
+					break;
+				}
 			case 9:
+				{
+					std::cout<<"Enter vendor id and product id in hex, and a timeout in ms, separated by spaces.\n";
+					rusbCtrl_deviceMatch_t match = {0};
+					unsigned int vendor, product;
+					int timeout, dev_id;
+					if(!(std::cin>>std::hex>>vendor>>product>>std::dec>>timeout))
+					{
+						std::cout<<"Whoops! Bad input.\n";
+						std::cin.clear();
+						std::cin.ignore(10000, '\n');
+					}
+					else
+					{
+						match.flags = RUSBCTRL_MATCH_VENDOR | RUSBCTRL_MATCH_PRODUCT;
+						match.vendorId = vendor;
+						match.productId = product;
+						int result = rusbCtrl_waitForDevice(&match, timeout, &dev_id);
+						if(0 == result)
+						{
+							std::cout<<"Found device "<<dev_id<<std::endl;
+						}
+						else
+						{
+							std::cout<<(RUSBCTRL_TIMEOUT == result ? "Timed out.\n" : "Failed.\n");
+						}
+					}
+					break;
+				}
+			case 10:
+				{
+					std::cout<<"Enter devId(integer).\n";
+					int dev_id;
+					rusbCtrl_deviceDescriptor_t device;
+					if(!(std::cin>>dev_id))
+					{
+						std::cout<<"Whoops! Bad input.\n";
+						std::cin.clear();
+						std::cin.ignore(10000, '\n');
+					}
+					else if(0 != rusbCtrl_getDeviceDescriptor(dev_id, &device))
+					{
+						std::cout<<"No descriptors for dev_id "<<dev_id<<std::endl;
+					}
+					else
+					{
+						printf("Device: USB %x.%02x, class 0x%02x, %04x:%04x, %d configuration(s)\n", device.bcdUSB >> 8,
+							device.bcdUSB & 0xff, device.deviceClass, device.vendorId, device.productId, device.numConfigurations);
+						rusbCtrl_configDescriptor_t config;
+						for(int c = 0; 0 == rusbCtrl_getConfigDescriptor(dev_id, c, &config); c++)
+						{
+							printf("  Configuration %d: %d mA%s%s\n", config.configurationValue, config.maxPowerMilliAmps,
+								(config.selfPowered ? ", self-powered" : ""), (config.remoteWakeup ? ", remote wakeup" : ""));
+							rusbCtrl_interfaceDescriptor_t interface;
+							for(int i = 0; 0 == rusbCtrl_getInterfaceDescriptor(dev_id, c, i, &interface); i++)
+							{
+								printf("    Interface %d.%d: class 0x%02x/0x%02x/0x%02x\n", interface.interfaceNumber,
+									interface.alternateSetting, interface.interfaceClass, interface.interfaceSubClass, interface.interfaceProtocol);
+								rusbCtrl_endpointDescriptor_t endpoint;
+								for(int e = 0; 0 == rusbCtrl_getEndpointDescriptor(dev_id, c, i, e, &endpoint); e++)
+								{
+									static const char *types[] = {"control", "isochronous", "bulk", "interrupt"};
+									printf("      Endpoint 0x%02x %s: %s, %d bytes x%d, interval %d\n", endpoint.address,
+										(endpoint.directionIn ? "IN" : "OUT"), types[endpoint.type], endpoint.maxPacketSize,
+										endpoint.transactionsPerMicroframe, endpoint.interval);
+								}
+							}
+						}
+					}
+					break;
+				}
+			case 11:
+				{
+					static bool early_enabled = false;
+					early_enabled = !early_enabled;
+					int result = rusbCtrl_enableEarlyNotification((early_enabled ? event_callback : NULL), NULL);
+					std::cout<<"Early notification "<<(early_enabled ? "enabled" : "disabled")<<", result "<<result<<std::endl;
+					break;
+				}
+			case 12:
 				keep_running = false;
 				std::cout<<"Quitting.\n";
 				break;
@@ -172,8 +321,52 @@ void launcher()
 	}
 }
 
+/* Times the device scan of rusbCtrl_init() over repeated runs. The first run is reported on its own: started right after
+ * boot, it is the cold-boot number. Set RUSBCTRL_PREFETCH=threads to compare the thread fallback with io_uring. */
+int bench_enumeration(int runs)
+{
+	std::vector<unsigned long> total_usecs, prefetch_usecs;
+	unsigned long devices = 0;
+	for(int i = 0; i < runs; i++)
+	{
+		rusbCtrl_stats_t stats;
+		if((0 != rusbCtrl_init()) || (0 != rusbCtrl_getStats(&stats)))
+		{
+			printf("Run %d failed.\n", i);
+			return 1;
+		}
+		rusbCtrl_term();
+		if(0 == i)
+		{
+			printf("First run: %lu devices in %luus, sysfs prefetch %luus\n", stats.enumeratedDevices, stats.enumerationUsecs,
+				stats.enumerationPrefetchUsecs);
+		}
+		devices = stats.enumeratedDevices;
+		total_usecs.push_back(stats.enumerationUsecs);
+		prefetch_usecs.push_back(stats.enumerationPrefetchUsecs);
+	}
+	std::sort(total_usecs.begin(), total_usecs.end());
+	std::sort(prefetch_usecs.begin(), prefetch_usecs.end());
+	const char *method = getenv("RUSBCTRL_PREFETCH");
+	printf("%d runs, %lu devices, RUSBCTRL_PREFETCH=%s\n", runs, devices, (NULL != method ? method : "(unset)"));
+	printf("Enumeration (us): best %lu, median %lu, worst %lu\n", total_usecs.front(), total_usecs[runs / 2], total_usecs.back());
+	printf("Sysfs prefetch (us): best %lu, median %lu, worst %lu\n", prefetch_usecs.front(), prefetch_usecs[runs / 2],
+		prefetch_usecs.back());
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
+	if((3 == argc) && (0 == strcmp(argv[1], "--bench-enumeration")))
+	{
+		int runs = atoi(argv[2]);
+		if(0 >= runs)
+		{
+			printf("Usage: %s [--bench-enumeration <runs>]\n", argv[0]);
+			return 1;
+		}
+		return bench_enumeration(runs);
+	}
 	launcher();
 	return 0;
 }